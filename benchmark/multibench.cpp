@@ -0,0 +1,478 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <fstream>
+
+#include <zlib.h>
+
+#include "hash.hpp"
+#include "multi.hpp"
+#include "compressor.hpp"
+#include "strutil.hpp"
+
+using namespace std::string_literals ;
+//================================================================================================
+//  Useage:
+//      multibench [benchmark [arguments]]
+//
+//  With no benchmark, every benchmark that needs no arguments is run.
+//  Timings are the average of a number of runs, in milliseconds
+//
+//================================================================================================
+
+//================================================================================================
+// Run func the number of times, and return the average milliseconds it took
+static auto timeit(int iterations, const std::function<void()> &func) ->double {
+    auto start = std::chrono::steady_clock::now() ;
+    for (auto j = 0 ; j < iterations ; j++){
+        func() ;
+    }
+    auto elapsed = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start) ;
+    return elapsed.count() / static_cast<double>(iterations) ;
+}
+//================================================================================================
+static auto report(const std::string &name, double milliseconds) ->void {
+    std::cout << "\t" << name << ": " << milliseconds << " ms\n";
+}
+
+//================================================================================================
+// Startup: building the multi hash set versus reading it from the cache
+static auto benchStartup(const std::vector<std::string> &arguments) ->void {
+    const auto format = "build/multicollection/%.6u.bin"s ;
+    auto cachepath = std::filesystem::temp_directory_path() / "multibench.hashcache" ;
+    report("build hashset (0-0x10000)", timeit(5, [&format](){
+        auto hashes = hashset_t(format,0,0x10000) ;
+    }));
+    auto hashes = hashset_t(format,0,0x10000) ;
+    if (!hashes.saveCache(cachepath,format,0,0x10000)){
+        throw std::runtime_error("Unable to create: "s + cachepath.string());
+    }
+    report("load hashset from cache", timeit(5, [&format,&cachepath](){
+        auto hashes = hashset_t() ;
+        if (!hashes.loadCache(cachepath,format,0,0x10000)){
+            throw std::runtime_error("Unable to load: "s + cachepath.string());
+        }
+    }));
+    if (!arguments.empty()){
+        // The first open of a process pays for the hashes (read from the cache, as multi
+        // does), the rest reuse them
+        multistorage_t::hashCache(cachepath) ;
+        report("first open of "s + arguments[0] + " (hashes from cache)"s, timeit(1, [&arguments](){
+            auto storage = multistorage_t(arguments[0]) ;
+        }));
+        report("open of "s + arguments[0], timeit(5, [&arguments](){
+            auto storage = multistorage_t(arguments[0]) ;
+        }));
+    }
+    std::filesystem::remove(cachepath) ;
+}
+
+//================================================================================================
+// hashLittle2: one key at a time versus the batch (simd) version
+static auto benchHashLittle2(const std::vector<std::string> &) ->void {
+    constexpr auto amount = std::size_t(0x10001 * 4) ;
+    const auto format = "build/multicollection/%.6u.bin"s ;
+    auto length = applyformat(format,0).size() ;
+    auto names = std::string() ;
+    auto keys = std::vector<std::string>() ;
+    for (std::size_t j = 0 ; j < amount ; j++){
+        keys.push_back(applyformat(format,static_cast<std::uint32_t>(j % 0x10001))) ;
+        names += keys.back() ;
+    }
+    auto single = std::vector<std::uint64_t>(amount) ;
+    auto batch = std::vector<std::uint64_t>(amount) ;
+    report("single ("s + std::to_string(amount) + " keys)"s, timeit(10, [&keys,&single](){
+        for (std::size_t j = 0 ; j < keys.size() ; j++){
+            single[j] = hashLittle2(keys[j]) ;
+        }
+    }));
+    report("batch ("s + std::to_string(amount) + " keys)"s, timeit(10, [&names,&batch,length](){
+        hashLittle2(names.data(),length,batch.size(),batch.data()) ;
+    }));
+    if (single != batch){
+        throw std::runtime_error("Batch hashes do not match single hashes");
+    }
+}
+
+//================================================================================================
+// Adler32: the original (a modulo per byte, a stream read per byte) against the current
+static auto legacyAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t {
+    std::uint32_t a = 1 ;
+    std::uint32_t b = 0 ;
+    for (const auto &entry : data ) {
+        a = (a + static_cast<std::uint32_t>(entry)) % 0xFFF1;
+        b = (b + a) % 0xFFF1 ;
+    }
+    return (b<<16)| a ;
+}
+static auto legacyAdler32(std::iostream &input,std::uint32_t amount) ->std::uint32_t {
+    std::uint32_t a = 1 ;
+    std::uint32_t b = 0 ;
+    auto entry = std::uint8_t(0);
+    for (std::uint32_t j = 0; j<amount ;j++) {
+        input.read(reinterpret_cast<char*>(&entry),sizeof(entry));
+        a = (a + static_cast<std::uint32_t>(entry)) % 0xFFF1;
+        b = (b + a) % 0xFFF1 ;
+    }
+    return (b<<16)| a ;
+}
+//================================================================================================
+static auto benchAdler32(const std::vector<std::string> &) ->void {
+    constexpr auto size = std::size_t(32 * 1024 * 1024) ;
+    auto data = std::vector<std::uint8_t>(size) ;
+    auto generator = std::mt19937(1) ;
+    for (auto &value : data){
+        value = static_cast<std::uint8_t>(generator()) ;
+    }
+    auto megabytes = static_cast<double>(size) / (1024.0 * 1024.0) ;
+    auto expected = legacyAdler32(data) ;
+    auto value = std::uint32_t(0) ;
+    auto time = timeit(3, [&data,&value](){ value = legacyAdler32(data) ; }) ;
+    report("legacy buffer ("s + std::to_string(megabytes / (time / 1000.0)) + " MB/s)"s, time) ;
+    time = timeit(3, [&data,&value](){ value = hashAdler32(data) ; }) ;
+    report("buffer ("s + std::to_string(megabytes / (time / 1000.0)) + " MB/s)"s, time) ;
+    if (value != expected){
+        throw std::runtime_error("Adler32 of buffer does not match");
+    }
+    auto stream = std::stringstream() ;
+    stream.write(reinterpret_cast<const char*>(data.data()),data.size()) ;
+    time = timeit(3, [&stream,&value](){ stream.seekg(0,std::ios::beg); value = legacyAdler32(stream,static_cast<std::uint32_t>(size)) ; }) ;
+    report("legacy stream ("s + std::to_string(megabytes / (time / 1000.0)) + " MB/s)"s, time) ;
+    time = timeit(3, [&stream,&value](){ stream.seekg(0,std::ios::beg); value = hashAdler32(stream,static_cast<std::uint32_t>(size)) ; }) ;
+    report("stream ("s + std::to_string(megabytes / (time / 1000.0)) + " MB/s)"s, time) ;
+    if (value != expected){
+        throw std::runtime_error("Adler32 of stream does not match");
+    }
+}
+
+//================================================================================================
+// Inflate: uncompress2 per entry versus a reused inflater_t
+static auto inflateEntries(const std::string &name, int count, std::size_t minimum, std::size_t spread) ->void {
+    auto generator = std::mt19937(1) ;
+    auto entries = std::vector<std::vector<std::uint8_t>>() ;
+    auto size = std::size_t(0) ;
+    for (auto j = 0 ; j < count ; j++){
+        auto data = std::vector<std::uint8_t>(minimum + generator() % spread) ;
+        for (auto &value : data){
+            value = static_cast<std::uint8_t>(generator() % 16) ;
+        }
+        auto destsize = compressBound(static_cast<uLong>(data.size())) ;
+        auto compressed = std::vector<std::uint8_t>(destsize) ;
+        compress(compressed.data(), &destsize, data.data(), static_cast<uLong>(data.size())) ;
+        compressed.resize(destsize) ;
+        size = std::max(size,data.size()) ;
+        entries.push_back(compressed) ;
+    }
+    auto output = std::vector<std::uint8_t>(size) ;
+    report("uncompress2 ("s + std::to_string(count) + " "s + name + " entries)"s, timeit(5, [&entries,&output](){
+        for (const auto &entry : entries){
+            auto destsize = static_cast<uLong>(output.size()) ;
+            auto srcsize = static_cast<uLong>(entry.size()) ;
+            uncompress2(output.data(), &destsize, entry.data(), &srcsize) ;
+        }
+    }));
+    report("inflater_t ("s + std::to_string(count) + " "s + name + " entries)"s, timeit(5, [&entries,&output](){
+        auto &inflater = inflater_t::local() ;
+        for (const auto &entry : entries){
+            inflater.decompress(entry.data(), entry.size(), output.data(), output.size()) ;
+        }
+    }));
+}
+static auto benchInflate(const std::vector<std::string> &) ->void {
+    // Entries about the size of a house, where the inflating is most of the time
+    inflateEntries("house sized"s, 2000, 1024, 8192) ;
+    // Most multis are only a few components (16 to 256 bytes), where setting up the
+    // stream for each entry counts the most.  With the whole output given, zlib never
+    // allocates its window, so what is saved is only inflateInit and inflateEnd
+    inflateEntries("small"s, 20000, 16, 240) ;
+}
+
+//================================================================================================
+// Csv: the getline/strutil parsing the tool used to have, versus multi_t(path)
+static auto legacyComponent(const std::string &entry) ->multi_component_t {
+    auto rvalue = multi_component_t() ;
+    auto comp = strutil::parse(entry,",") ;
+    switch (comp.size()){
+        default:
+        case 6: {
+            auto values = strutil::parse(comp.at(5),":") ;
+            for (const auto &value:values){
+                if (!value.empty()) {
+                    rvalue.cliloc.push_back(strutil::ston<std::uint32_t>(value));
+                }
+            }
+            [[fallthrough]];
+        }
+        case 5:
+            rvalue.flag = strutil::ston<std::uint64_t>(comp.at(4));
+            [[fallthrough]];
+        case 4:
+            rvalue.offsetz = strutil::ston<std::int16_t>(comp.at(3));
+            [[fallthrough]];
+        case 3:
+            rvalue.offsety = strutil::ston<std::int16_t>(comp.at(2));
+            [[fallthrough]];
+        case 2:
+            rvalue.offsetx = strutil::ston<std::int16_t>(comp.at(1));
+            [[fallthrough]];
+        case 1:
+            rvalue.tileid = strutil::ston<std::uint16_t>(comp.at(0));
+            [[fallthrough]];
+        case 0:
+            break;
+    }
+    return rvalue ;
+}
+//================================================================================================
+static auto legacyMulti(const std::filesystem::path &csvfile) ->multi_t {
+    auto rvalue = multi_t() ;
+    auto input = std::ifstream(csvfile.string());
+    if (!input.is_open()){
+        throw std::runtime_error("Unable to open: "s+csvfile.string());
+    }
+    auto data = std::vector<char>(2049,0) ;
+    while(input.good() && !input.eof()){
+        input.getline(data.data(), 2048) ;
+        std::string text = data.data() ;
+        if (!text.empty()){
+            auto [first,rest] = strutil::split(text,",");
+            if ((strutil::lower(first) != "tileid") && (!rest.empty())) {
+                rvalue.data.push_back(legacyComponent(text));
+            }
+        }
+    }
+    return rvalue ;
+}
+//================================================================================================
+static auto benchCSV(const std::vector<std::string> &) ->void {
+    // Some house sized csv files
+    constexpr auto count = 200 ;
+    auto directory = std::filesystem::temp_directory_path() / "multibench_csv" ;
+    std::filesystem::create_directories(directory) ;
+    auto generator = std::mt19937(1) ;
+    auto files = std::vector<std::filesystem::path>() ;
+    for (auto j = 0 ; j < count ; j++){
+        auto multi = multi_t() ;
+        auto components = 50 + generator() % 400 ;
+        for (std::uint32_t i = 0 ; i < components ; i++){
+            auto component = multi_component_t() ;
+            component.tileid = static_cast<std::uint16_t>(generator()) ;
+            component.offsetx = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+            component.offsety = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+            component.offsetz = static_cast<std::int16_t>(generator() % 64) ;
+            component.flag = generator() % 2 ;
+            if (generator() % 8 == 0){
+                component.cliloc.push_back(1000000 + generator() % 100000) ;
+            }
+            multi.data.push_back(component) ;
+        }
+        files.push_back(directory / (std::to_string(j) + ".csv"s)) ;
+        auto output = std::ofstream(files.back().string()) ;
+        multi.description(output) ;
+    }
+    for (const auto &file : files){
+        if (legacyMulti(file).record(true) != multi_t(file).record(true)){
+            throw std::runtime_error("Parsers do not agree on: "s + file.string());
+        }
+    }
+    report("legacy parser ("s + std::to_string(count) + " files)"s, timeit(5, [&files](){
+        for (const auto &file : files){
+            auto multi = legacyMulti(file) ;
+        }
+    }));
+    report("multi_t(path) ("s + std::to_string(count) + " files)"s, timeit(5, [&files](){
+        for (const auto &file : files){
+            auto multi = multi_t(file) ;
+        }
+    }));
+    std::filesystem::remove_all(directory) ;
+}
+
+//================================================================================================
+// Describe: the stringstream/ntos csv output the tool used to have, versus the buffered writer
+static auto legacyDescription(const multi_component_t &component) ->std::string {
+    std::stringstream output ;
+    output << strutil::ntos<std::uint16_t>(component.tileid,strutil::radix_t::hex,true,4)<<",";
+    output<<strutil::ntos<std::int16_t>(component.offsetx)<<",";
+    output<<strutil::ntos<std::int16_t>(component.offsety)<<",";
+    output<<strutil::ntos<std::int16_t>(component.offsetz)<<",";
+    output<<strutil::ntos<std::uint64_t>(component.flag,strutil::radix_t::hex,true) <<",";
+    for (const auto &value:component.cliloc) {
+        output<<strutil::ntos<std::uint32_t>(value)<<":";
+    }
+    return output.str() ;
+}
+//================================================================================================
+static auto legacyDescription(const multi_t &multi, std::ostream &output) ->void {
+    output <<"TileID,OffsetX,OffsetY,OffsetZ,Flag,Cliloc\n";
+    for (const auto &rec:multi.data){
+        output << legacyDescription(rec)<<"\n";
+    }
+}
+//================================================================================================
+static auto benchDescribe(const std::vector<std::string> &) ->void {
+    constexpr auto count = 200 ;
+    auto generator = std::mt19937(1) ;
+    auto multis = std::vector<multi_t>(count) ;
+    for (auto &multi : multis){
+        auto components = 50 + generator() % 400 ;
+        for (std::uint32_t i = 0 ; i < components ; i++){
+            auto component = multi_component_t() ;
+            component.tileid = static_cast<std::uint16_t>(generator()) ;
+            component.offsetx = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+            component.offsety = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+            component.offsetz = static_cast<std::int16_t>(generator() % 64) ;
+            component.flag = (static_cast<std::uint64_t>(generator()) << (generator() % 40)) ;
+            if (generator() % 8 == 0){
+                component.cliloc.push_back(1000000 + generator() % 100000) ;
+            }
+            multi.data.push_back(component) ;
+        }
+    }
+    for (const auto &multi : multis){
+        auto legacy = std::stringstream() ;
+        auto current = std::stringstream() ;
+        legacyDescription(multi,legacy) ;
+        multi.description(current) ;
+        if (legacy.str() != current.str()){
+            throw std::runtime_error("Descriptions do not agree");
+        }
+    }
+    report("legacy description ("s + std::to_string(count) + " multis)"s, timeit(5, [&multis](){
+        auto output = std::stringstream() ;
+        for (const auto &multi : multis){
+            legacyDescription(multi,output) ;
+        }
+    }));
+    report("description ("s + std::to_string(count) + " multis)"s, timeit(5, [&multis](){
+        auto output = std::stringstream() ;
+        for (const auto &multi : multis){
+            multi.description(output) ;
+        }
+    }));
+}
+
+//================================================================================================
+// Compress: compress() per entry, versus a deflater_t with each compression preset, for
+// throughput and the total stored size.  The records are those of a uop if given, otherwise
+// generated (house sized, with some tiny ones)
+static auto benchCompress(const std::vector<std::string> &arguments) ->void {
+    auto records = std::vector<std::vector<std::uint8_t>>() ;
+    if (!arguments.empty()){
+        auto storage = multistorage_t(arguments[0]) ;
+        for (auto id : storage.ids()){
+            records.push_back(storage[id].record(true)) ;
+        }
+    }
+    else {
+        auto generator = std::mt19937(1) ;
+        for (auto j = 0 ; j < 2000 ; j++){
+            auto multi = multi_t() ;
+            auto components = (j % 4 == 0) ? 1 + generator() % 3 : 50 + generator() % 400 ;
+            for (std::uint32_t i = 0 ; i < components ; i++){
+                auto component = multi_component_t() ;
+                component.tileid = static_cast<std::uint16_t>(generator() % 0x4000) ;
+                component.offsetx = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+                component.offsety = static_cast<std::int16_t>(static_cast<int>(generator() % 32) - 16) ;
+                component.offsetz = static_cast<std::int16_t>(generator() % 64) ;
+                component.flag = generator() % 2 ;
+                multi.data.push_back(component) ;
+            }
+            records.push_back(multi.record(true)) ;
+        }
+    }
+    auto total = std::size_t(0) ;
+    for (const auto &record : records){
+        total += record.size() ;
+    }
+    std::cout << "\t" << records.size() << " records, " << total << " bytes\n";
+    auto output = std::vector<std::uint8_t>() ;
+    auto stored = std::size_t(0) ;
+    report("compress", timeit(3, [&records,&output,&stored](){
+        stored = 0 ;
+        for (const auto &record : records){
+            auto destsize = compressBound(static_cast<uLong>(record.size())) ;
+            output.resize(destsize) ;
+            compress(output.data(), &destsize, record.data(), static_cast<uLong>(record.size())) ;
+            stored += destsize ;
+        }
+    }));
+    std::cout << "\t\tstored: " << stored << " bytes\n";
+    for (const auto &name : {"default"s, "fast"s, "small"s}){
+        auto policy = compressionpolicy_t::preset(name) ;
+        auto raw = std::size_t(0) ;
+        report("deflater_t "s + name, timeit(3, [&records,&output,&stored,&raw,&policy](){
+            auto &deflater = deflater_t::local() ;
+            stored = 0 ;
+            raw = 0 ;
+            for (const auto &record : records){
+                if (!deflater.compress(record.data(), record.size(), output, policy)){
+                    raw++ ;
+                }
+                stored += output.size() ;
+            }
+        }));
+        std::cout << "\t\tstored: " << stored << " bytes (" << raw << " raw)\n";
+    }
+}
+
+//================================================================================================
+struct benchmark_t {
+    std::string name ;
+    std::string arguments ;
+    std::function<void(const std::vector<std::string>&)> run ;
+};
+static const auto benchmarks = std::vector<benchmark_t>{
+    {"startup"s, "[uopfile]"s, benchStartup},
+    {"hashlittle2"s, ""s, benchHashLittle2},
+    {"adler32"s, ""s, benchAdler32},
+    {"inflate"s, ""s, benchInflate},
+    {"compress"s, "[uopfile]"s, benchCompress},
+    {"csv"s, ""s, benchCSV},
+    {"describe"s, ""s, benchDescribe}
+};
+
+//================================================================================================
+int main(int argc, const char * argv[]) {
+    auto exitcode = EXIT_SUCCESS;
+    try {
+        auto name = std::string() ;
+        auto arguments = std::vector<std::string>() ;
+        if (argc > 1){
+            name = strutil::lower(argv[1]) ;
+            for (auto j = 2 ; j < argc ; j++){
+                arguments.push_back(argv[j]) ;
+            }
+        }
+        auto found = false ;
+        for (const auto &bench : benchmarks){
+            if (name.empty() || (name == bench.name)){
+                found = true ;
+                std::cout << bench.name << "\n";
+                bench.run(arguments) ;
+            }
+        }
+        if (!found){
+            std::cout <<"Usage:\n";
+            std::cout <<"\tmultibench [benchmark [arguments]]\n";
+            std::cout <<"\t\tWhere benchmark is one of:\n";
+            for (const auto &bench : benchmarks){
+                std::cout << "\t\t\t" << bench.name << " " << bench.arguments << "\n";
+            }
+        }
+    }
+    catch(const std::exception &e){
+        std::cerr<<e.what()<<std::endl;
+        exitcode = EXIT_FAILURE;
+    }
+    return exitcode;
+}
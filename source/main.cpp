@@ -5,8 +5,15 @@
 #include <stdexcept>
 #include <string>
 #include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <iterator>
+#include <charconv>
+#include <system_error>
+#include <cstdint>
 
 #include "multi.hpp"
+#include "bundle.hpp"
 #include "strutil.hpp"
 #include "argument.hpp"
 
@@ -21,26 +28,173 @@ using namespace std::string_literals ;
 //      --mul= idxfilepath,mulfilepath
 //      --extract extract the data from the mul/uop file
 //      --create create the requested file
+//      --jobs= number of threads to use (default is one per core, at most four per core)
+//      --bundle entrydirectory is instead a bundle file (all the multis in one file), when
+//               creating this is assumed if entrydirectory is a file
+//      --incremental with --create, only redo the entries whose csv changed since the last time
+//      --dedup when creating a uop, store identical multis only once
+//      --compression= default, fast (quickest build) or small (smallest file) when creating a uop
+//      --convert= uop or mul, create that from the other (--uop and --mul), no entrydirectory
+//      --hashcache= where the multi id hashes are cached between runs (empty for none),
+//                   the default is multi/multicollection.hashcache in the user's cache directory
 //
 //================================================================================================
 
+//================================================================================================
+// The multi id hashes cache in the user's own cache directory (empty if there is none)
+static auto userHashCache() ->std::filesystem::path {
+    auto directory = std::filesystem::path() ;
+#if defined(_WIN32)
+    auto base = std::getenv("LOCALAPPDATA") ;
+    if ((base != nullptr) && (*base != 0)){
+        directory = std::filesystem::path(base) / "multi" ;
+    }
+#else
+    auto base = std::getenv("XDG_CACHE_HOME") ;
+    auto home = std::getenv("HOME") ;
+    if ((base != nullptr) && (*base != 0)){
+        directory = std::filesystem::path(base) / "multi" ;
+    }
+    else if ((home != nullptr) && (*home != 0)){
+        directory = std::filesystem::path(home) / ".cache" / "multi" ;
+    }
+#endif
+    if (directory.empty()){
+        return directory ;
+    }
+    auto ec = std::error_code() ;
+    std::filesystem::create_directories(directory, ec) ;
+    if (ec){
+        return std::filesystem::path() ;
+    }
+    return directory / "multicollection.hashcache" ;
+}
+
 int main(int argc, const char * argv[]) {
     auto exitcode = EXIT_SUCCESS;
     try {
         auto arg = argument_t(argc,argv) ;
-        if (arg.paths.size() <2){
+        auto housepath = std::filesystem::path("housing.bin");
+        auto housegiven = false ;
+        auto extract = true ;
+        auto bundle = false ;
+        auto incremental = false ;
+        auto options = uopoptions_t() ;
+        auto jobs = std::size_t(0) ;
+        auto convert = std::string() ;
+        auto uoppath = std::filesystem::path() ;
+        auto idxpath = std::filesystem::path() ;
+        auto mulpath = std::filesystem::path() ;
+        auto hashcache = std::filesystem::path() ;
+        auto hashcachegiven = false ;
+        for (const auto &[flag,value]:arg.flags){
+            if ((flag == "house") || (flag == "housing")){
+                housepath = std::filesystem::path(value) ;
+                housegiven = true ;
+            }
+            else if (flag == "create"){
+                extract = false ;
+            }
+            else if (flag == "extract"){
+                extract = true ;
+            }
+            else if (flag == "jobs"){
+                // A count of threads, anything but a whole number above zero is a mistake
+                auto count = std::int64_t(0) ;
+                auto [ptr,ec] = std::from_chars(value.data(), value.data() + value.size(), count) ;
+                if ((ec != std::errc()) || (ptr != value.data() + value.size()) || (count <= 0)){
+                    throw std::runtime_error("Invalid --jobs (must be a positive integer): "s + value);
+                }
+                jobs = static_cast<std::size_t>(count) ;
+            }
+            else if (flag == "bundle"){
+                bundle = true ;
+            }
+            else if (flag == "incremental"){
+                incremental = true ;
+            }
+            else if (flag == "dedup"){
+                options.dedup = true ;
+            }
+            else if (flag == "compression"){
+                options.compression = compressionpolicy_t::preset(strutil::lower(value)) ;
+            }
+            else if (flag == "convert"){
+                convert = strutil::lower(value) ;
+            }
+            else if (flag == "uop"){
+                uoppath = std::filesystem::path(value) ;
+            }
+            else if (flag == "hashcache"){
+                hashcache = std::filesystem::path(value) ;
+                hashcachegiven = true ;
+            }
+            else if (flag == "mul"){
+                auto [idx,mul] = strutil::split(value,",") ;
+                idxpath = std::filesystem::path(idx) ;
+                mulpath = std::filesystem::path(mul) ;
+            }
+        }
+        // Opening a uop then only has to read the hashes, rather than build them
+        multistorage_t::hashCache(hashcachegiven ? hashcache : userHashCache()) ;
+        if (!convert.empty()){
+            if (uoppath.empty() || idxpath.empty() || mulpath.empty()){
+                throw std::runtime_error("Convert requires both --uop=uoppath and --mul=idxpath,mulpath"s);
+            }
+            // Straight from one format to the other, no csv files in between
+            if (convert == "mul"){
+                auto source = multistorage_t(uoppath) ;
+                multistorage_t::saveMUL(source, mulpath, idxpath, jobs) ;
+                if (housegiven){
+                    source.saveHousing(housepath) ;
+                }
+            }
+            else if (convert == "uop"){
+                auto housing = std::ifstream(housepath.string(),std::ios::binary) ;
+                if (!housing.is_open()){
+                    throw std::runtime_error("Unable to open: "s + housepath.string());
+                }
+                auto house = std::vector<std::uint8_t>(std::istreambuf_iterator<char>(housing),std::istreambuf_iterator<char>()) ;
+                multistorage_t::saveUOP(multistorage_t(mulpath,idxpath), uoppath, house, jobs, options) ;
+            }
+            else {
+                throw std::runtime_error("Unknown convert format (use uop or mul): "s + convert);
+            }
+        }
+        else if (arg.paths.size() <2){
             std::cout <<"Insufficent paramaters.\n";
             std::cout <<"Usage:\n";
             std::cout <<"\tmulti flag csvdirectory uoppath \n";
             std::cout <<"\t\tWhere flag is --extract or --create\n";
             std::cout <<"\t\tOptionally one may include a flag: --housing=housingname\n";
             std::cout <<"\t\twhich will use that file name in the cvsdirectory for the housing.bin\n";
+            std::cout <<"\t\tand --jobs=N for the number of threads to use (default is one per core)\n";
+            std::cout <<"\t\tand --bundle to use a bundle file, rather than the csvdirectory\n";
+            std::cout <<"\t\tand --incremental to only redo the csv files changed since the last create\n";
+            std::cout <<"\t\tand --dedup to store identical multis in the uop only once\n";
+            std::cout <<"\t\tand --compression=fast or small for the quickest build or smallest uop\n";
             std::cout <<"Or\n";
             std::cout <<"\tmulti flag csvdirectory idxpath mulpath\n";
             std::cout <<"\t\tWhere flag is --extract or --create\n";
+            std::cout <<"Or\n";
+            std::cout <<"\tmulti --convert=format --uop=uoppath --mul=idxpath,mulpath\n";
+            std::cout <<"\t\tWhere format (uop or mul) is the one to create, from the other\n";
+            std::cout <<"\t\tA uop needs --housing=housingpath, for a mul it is saved there if given\n";
         }
         else {
-            if (!std::filesystem::exists(arg.paths[0])){
+            if (!extract){
+                // A file rather than a csv directory can only be a bundle
+                if (!bundle && std::filesystem::is_regular_file(arg.paths[0])){
+                    if (!bundle_t::isBundle(arg.paths[0])){
+                        throw std::runtime_error("Not a csv directory or a bundle: "s + arg.paths[0].string());
+                    }
+                    bundle = true ;
+                }
+                if (bundle && !bundle_t::isBundle(arg.paths[0])){
+                    throw std::runtime_error("Not a bundle: "s + arg.paths[0].string());
+                }
+            }
+            if (!bundle && !std::filesystem::exists(arg.paths[0])){
                 try{
                     std::filesystem::create_directories(arg.paths[0]);
                 }
@@ -48,19 +202,6 @@ int main(int argc, const char * argv[]) {
                     throw std::runtime_error("Unable to create: "s+arg.paths[0].string());
                 }
             }
-            auto housepath = std::filesystem::path("housing.bin");
-            auto extract = true ;
-            for (const auto &[flag,value]:arg.flags){
-                if (flag == "house"){
-                    housepath = std::filesystem::path(value) ;
-                }
-                else if (flag == "create"){
-                    extract = false ;
-                }
-                else if (flag == "extract"){
-                    extract = true ;
-                }
-            }
             if (extract) {
                 auto multistorage = multistorage_t() ;
                 if (arg.paths.size() >2) {
@@ -69,31 +210,44 @@ int main(int argc, const char * argv[]) {
                 else {
                     multistorage = multistorage_t(arg.paths[1]);
                 }
-                auto maxid = multistorage.maxid() ;
-                for (std::uint32_t j=0 ; j < maxid+1;j++){
-                    auto multi = multistorage[j] ;
-                    if (!multi.empty()){
+                if (bundle){
+                    multistorage.saveBundle(arg.paths[0]) ;
+                    return exitcode ;
+                }
+                // One pass through the file, in the order the data is in it, each
+                // worker writes the files for the entries it decodes
+                multistorage.extract([&arg](std::uint32_t j, const multi_view_t &view){
+                    if (!view.empty()){
                         auto filename = arg.paths[0]/std::filesystem::path( strutil::format("%.4u.csv",j) );
                         auto output = std::ofstream(filename.string());
                         if (!output.is_open()) {
                             throw std::runtime_error("Unable to create: "s +filename.string() );
                         }
-                        multi.description(output);
+                        multi_t(view).description(output);
                     }
-                }
+                }, jobs);
                 if (multistorage.uop()){
                     auto filename = arg.paths[0] / housepath ;
                     multistorage.saveHousing(filename );
                 }
                 
             }
+            else if (bundle) {
+                auto source = bundle_t(arg.paths[0]) ;
+                if (arg.paths.size()>2) {
+                    multistorage_t::saveMUL(source, arg.paths[2], arg.paths[1],jobs);
+                }
+                else {
+                    multistorage_t::saveUOP(source, arg.paths[1],jobs,options);
+                }
+            }
             else {
                 if (arg.paths.size()>2) {
                     // This is a mul
-                    multistorage_t::saveMUL(arg.paths[0], arg.paths[2], arg.paths[1]);
+                    multistorage_t::saveMUL(arg.paths[0], arg.paths[2], arg.paths[1],jobs,incremental);
                 }
                 else {
-                    multistorage_t::saveUOP(arg.paths[0], arg.paths[1],housepath);
+                    multistorage_t::saveUOP(arg.paths[0], arg.paths[1],housepath,jobs,incremental,options);
                 }
             }
         }
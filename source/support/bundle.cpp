@@ -0,0 +1,221 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "bundle.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std::string_literals;
+
+//=================================================================================
+//  bundlewriter_t
+//=================================================================================
+//=================================================================================
+bundlewriter_t::bundlewriter_t(const std::filesystem::path &path):components(0),record(bundle_t::component_size,0) {
+    // The buffer has to be set before the file is opened to take effect
+    buffer.resize(buffer_size) ;
+    output.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    output.open(path.string(),std::ios::binary) ;
+    if (output.is_open()){
+        // The header is filled in on close
+        auto header = std::vector<char>(bundle_t::header_size,0) ;
+        output.write(header.data(),header.size()) ;
+    }
+}
+//=================================================================================
+auto bundlewriter_t::is_open() const ->bool {
+    return output.is_open() ;
+}
+//=================================================================================
+auto bundlewriter_t::addComponent(std::uint16_t tileid, std::int16_t offsetx, std::int16_t offsety, std::int16_t offsetz, std::uint64_t flag, std::uint32_t count) ->void {
+    writeValue(record.data(),tileid) ;
+    writeValue(record.data()+2,offsetx) ;
+    writeValue(record.data()+4,offsety) ;
+    writeValue(record.data()+6,offsetz) ;
+    writeValue(record.data()+8,flag) ;
+    writeValue(record.data()+16,static_cast<std::uint32_t>(clilocs.size() - count)) ;
+    writeValue(record.data()+20,count) ;
+    output.write(reinterpret_cast<char*>(record.data()),record.size()) ;
+    components++ ;
+}
+//=================================================================================
+auto bundlewriter_t::add(std::uint32_t id, const multi_t &multi) ->void {
+    auto first = components ;
+    for (const auto &component : multi.data){
+        clilocs.insert(clilocs.end(),component.cliloc.begin(),component.cliloc.end()) ;
+        addComponent(component.tileid, component.offsetx, component.offsety, component.offsetz, component.flag, static_cast<std::uint32_t>(component.cliloc.size())) ;
+    }
+    directory.push_back(directory_t{id,static_cast<std::uint32_t>(components - first),first}) ;
+}
+//=================================================================================
+auto bundlewriter_t::add(std::uint32_t id, const multi_view_t &multi) ->void {
+    auto first = components ;
+    for (const auto &component : multi){
+        for (std::uint32_t j = 0 ; j < component.clilocCount() ; j++){
+            clilocs.push_back(component.cliloc(j)) ;
+        }
+        addComponent(component.tileid(), component.offsetx(), component.offsety(), component.offsetz(), component.flag(), component.clilocCount()) ;
+    }
+    directory.push_back(directory_t{id,static_cast<std::uint32_t>(components - first),first}) ;
+}
+//=================================================================================
+auto bundlewriter_t::close(const std::vector<std::uint8_t> &housing) ->void {
+    if (!output.is_open()){
+        return ;
+    }
+    std::stable_sort(directory.begin(),directory.end(),[](const directory_t &lhs, const directory_t &rhs){
+        return lhs.id < rhs.id ;
+    });
+    for (std::size_t j = 1 ; j < directory.size() ; j++){
+        if (directory[j].id == directory[j-1].id){
+            throw std::runtime_error("Multi id added to the bundle more than once: "s + std::to_string(directory[j].id));
+        }
+    }
+    auto clilocoffset = static_cast<std::uint64_t>(bundle_t::header_size) + components * bundle_t::component_size ;
+    output.write(reinterpret_cast<const char*>(clilocs.data()),clilocs.size() * sizeof(std::uint32_t)) ;
+    auto housingoffset = clilocoffset + clilocs.size() * sizeof(std::uint32_t) ;
+    output.write(reinterpret_cast<const char*>(housing.data()),housing.size()) ;
+    auto directoryoffset = housingoffset + housing.size() ;
+    auto table = std::vector<std::uint8_t>(directory.size() * bundle_t::directory_size) ;
+    for (std::size_t j = 0 ; j < directory.size() ; j++){
+        auto ptr = table.data() + j * bundle_t::directory_size ;
+        writeValue(ptr,directory[j].id) ;
+        writeValue(ptr+4,directory[j].count) ;
+        writeValue(ptr+8,directory[j].first) ;
+    }
+    output.write(reinterpret_cast<char*>(table.data()),table.size()) ;
+
+    auto header = std::vector<std::uint8_t>(bundle_t::header_size,0) ;
+    writeValue(header.data(),bundle_t::signature) ;
+    writeValue(header.data()+4,bundle_t::version) ;
+    writeValue(header.data()+8,static_cast<std::uint32_t>(directory.size())) ;
+    writeValue(header.data()+16,directoryoffset) ;
+    writeValue(header.data()+24,static_cast<std::uint64_t>(bundle_t::header_size)) ;
+    writeValue(header.data()+32,components) ;
+    writeValue(header.data()+40,clilocoffset) ;
+    writeValue(header.data()+48,static_cast<std::uint64_t>(clilocs.size())) ;
+    writeValue(header.data()+56,housingoffset) ;
+    output.seekp(0,std::ios::beg) ;
+    output.write(reinterpret_cast<char*>(header.data()),header.size()) ;
+    if (!output.good()){
+        throw std::runtime_error("Error writing the bundle"s);
+    }
+    output.close() ;
+}
+
+//=================================================================================
+//  bundle_t
+//=================================================================================
+//=================================================================================
+bundle_t::bundle_t(const std::filesystem::path &path):count(0),directory(0),components(0),numcomponents(0),clilocs(0),numclilocs(0),housingoffset(0) {
+    if (!file.open(path)){
+        throw std::runtime_error("Failed to open: "s + path.string());
+    }
+    auto size = static_cast<std::uint64_t>(file.size()) ;
+    if (size < header_size){
+        throw std::runtime_error("Invalid bundle: "s + path.string());
+    }
+    auto header = file.data() ;
+    if ((readValue<std::uint32_t>(header) != signature) || (readValue<std::uint32_t>(header+4) != version)){
+        throw std::runtime_error("Invalid bundle (or unsupported version): "s + path.string());
+    }
+    count = readValue<std::uint32_t>(header+8) ;
+    directory = readValue<std::uint64_t>(header+16) ;
+    components = readValue<std::uint64_t>(header+24) ;
+    numcomponents = readValue<std::uint64_t>(header+32) ;
+    clilocs = readValue<std::uint64_t>(header+40) ;
+    numclilocs = readValue<std::uint64_t>(header+48) ;
+    housingoffset = readValue<std::uint64_t>(header+56) ;
+    // Everything must be inside the file
+    auto inside = [size](std::uint64_t offset, std::uint64_t number, std::uint64_t itemsize){
+        return (offset <= size) && (number <= (size - offset) / itemsize) ;
+    };
+    if (!inside(directory,count,directory_size) || !inside(components,numcomponents,component_size) || !inside(clilocs,numclilocs,sizeof(std::uint32_t)) || (housingoffset > directory)){
+        throw std::runtime_error("Invalid bundle: "s + path.string());
+    }
+}
+//=================================================================================
+auto bundle_t::isBundle(const std::filesystem::path &path) ->bool {
+    auto input = std::ifstream(path.string(),std::ios::binary) ;
+    auto value = std::uint32_t(0) ;
+    input.read(reinterpret_cast<char*>(&value),sizeof(value)) ;
+    return input.good() && (value == signature) ;
+}
+//=================================================================================
+auto bundle_t::find(std::uint32_t id) const ->const std::uint8_t* {
+    // The directory is sorted by id
+    auto base = file.data() + directory ;
+    auto low = std::size_t(0) ;
+    auto high = static_cast<std::size_t>(count) ;
+    while (low < high){
+        auto middle = low + (high - low) / 2 ;
+        auto entry = base + middle * directory_size ;
+        auto value = readValue<std::uint32_t>(entry) ;
+        if (value == id){
+            return entry ;
+        }
+        if (value < id){
+            low = middle + 1 ;
+        }
+        else {
+            high = middle ;
+        }
+    }
+    return nullptr ;
+}
+//=================================================================================
+auto bundle_t::maxid() const ->std::uint32_t {
+    if (count == 0){
+        return 0 ;
+    }
+    return readValue<std::uint32_t>(file.data() + directory + static_cast<std::uint64_t>(count - 1) * directory_size) ;
+}
+//=================================================================================
+auto bundle_t::ids() const ->std::vector<std::uint32_t> {
+    auto rvalue = std::vector<std::uint32_t>(count) ;
+    auto ptr = file.data() + directory ;
+    for (auto &id : rvalue){
+        id = readValue<std::uint32_t>(ptr) ;
+        ptr += directory_size ;
+    }
+    return rvalue ;
+}
+//=================================================================================
+auto bundle_t::housing() const ->byteview_t {
+    return file.view(housingoffset, directory - housingoffset) ;
+}
+//=================================================================================
+auto bundle_t::operator[](std::uint32_t id) const ->multi_t {
+    auto rvalue = multi_t() ;
+    auto entry = find(id) ;
+    if (entry == nullptr){
+        return rvalue ;
+    }
+    auto number = readValue<std::uint32_t>(entry+4) ;
+    auto first = readValue<std::uint64_t>(entry+8) ;
+    if ((first > numcomponents) || (number > numcomponents - first)){
+        throw std::runtime_error("Invalid bundle entry: "s + std::to_string(id));
+    }
+    rvalue.data.resize(number) ;
+    auto ptr = file.data() + components + first * component_size ;
+    for (auto &component : rvalue.data){
+        component.tileid = readValue<std::uint16_t>(ptr) ;
+        component.offsetx = readValue<std::int16_t>(ptr+2) ;
+        component.offsety = readValue<std::int16_t>(ptr+4) ;
+        component.offsetz = readValue<std::int16_t>(ptr+6) ;
+        component.flag = readValue<std::uint64_t>(ptr+8) ;
+        auto cliloc = static_cast<std::uint64_t>(readValue<std::uint32_t>(ptr+16)) ;
+        auto amount = static_cast<std::uint64_t>(readValue<std::uint32_t>(ptr+20)) ;
+        if ((cliloc > numclilocs) || (amount > numclilocs - cliloc)){
+            throw std::runtime_error("Invalid bundle entry: "s + std::to_string(id));
+        }
+        auto values = file.data() + clilocs + cliloc * sizeof(std::uint32_t) ;
+        component.cliloc.resize(amount) ;
+        for (auto &value : component.cliloc){
+            value = readValue<std::uint32_t>(values) ;
+            values += sizeof(std::uint32_t) ;
+        }
+        ptr += component_size ;
+    }
+    return rvalue ;
+}
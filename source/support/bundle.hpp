@@ -0,0 +1,114 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef bundle_hpp
+#define bundle_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+#include "mapfile.hpp"
+#include "multi.hpp"
+//=================================================================================
+// A multi bundle is a whole multi collection (and housing.bin) in one binary file,
+// quick to write and to map, rather than thousands of csv files.
+//
+// Format (little endian):
+//  header (64 bytes)
+//      std::uint32_t   signature ("MLTB")
+//      std::uint32_t   version
+//      std::uint32_t   number of multis
+//      std::uint32_t   unused (0)
+//      std::uint64_t   offset of the directory
+//      std::uint64_t   offset of the components
+//      std::uint64_t   number of components
+//      std::uint64_t   offset of the clilocs
+//      std::uint64_t   number of clilocs
+//      std::uint64_t   offset of housing.bin (the size is directory offset - this)
+//  components (24 bytes each)
+//      std::uint16_t   tileid
+//      std::int16_t    offsetx
+//      std::int16_t    offsety
+//      std::int16_t    offsetz
+//      std::uint64_t   flag
+//      std::uint32_t   index of the first cliloc
+//      std::uint32_t   number of clilocs
+//  clilocs (std::uint32_t each)
+//  housing.bin (may be empty)
+//  directory, sorted by id (16 bytes each)
+//      std::uint32_t   id
+//      std::uint32_t   number of components
+//      std::uint64_t   index of the first component
+//=================================================================================
+
+//=================================================================================
+//  bundlewriter_t ;
+//=================================================================================
+// Writes a bundle front to back, the components are written as multis are added,
+// the rest is kept until close.  Multis can be added in any order.
+//=================================================================================
+class bundlewriter_t {
+    struct directory_t {
+        std::uint32_t id ;
+        std::uint32_t count ;
+        std::uint64_t first ;
+    };
+    std::vector<char> buffer ;
+    std::ofstream output ;
+    std::vector<directory_t> directory ;
+    std::vector<std::uint32_t> clilocs ;
+    std::uint64_t components ;
+    std::vector<std::uint8_t> record ;
+    auto addComponent(std::uint16_t tileid, std::int16_t offsetx, std::int16_t offsety, std::int16_t offsetz, std::uint64_t flag, std::uint32_t clilocs) ->void ;
+public:
+    static constexpr auto buffer_size = std::size_t(1024 * 1024) ;
+    bundlewriter_t(const std::filesystem::path &path) ;
+    bundlewriter_t(const bundlewriter_t&) = delete ;
+    auto operator=(const bundlewriter_t&) ->bundlewriter_t& = delete ;
+    auto is_open() const ->bool ;
+    auto add(std::uint32_t id, const multi_t &multi) ->void ;
+    auto add(std::uint32_t id, const multi_view_t &multi) ->void ;
+    // Writes the rest of the bundle, and closes the file
+    auto close(const std::vector<std::uint8_t> &housing) ->void ;
+};
+
+//=================================================================================
+//  bundle_t ;
+//=================================================================================
+// A bundle, memory mapped and read in place.  Nothing is modified after it is opened,
+// so any number of threads may read from it at the same time.
+//=================================================================================
+class bundle_t {
+    mappedfile_t file ;
+    std::uint32_t count ;
+    std::uint64_t directory ;
+    std::uint64_t components ;
+    std::uint64_t numcomponents ;
+    std::uint64_t clilocs ;
+    std::uint64_t numclilocs ;
+    std::uint64_t housingoffset ;
+    // The directory entry for an id, or nullptr
+    auto find(std::uint32_t id) const ->const std::uint8_t* ;
+public:
+    static constexpr auto signature = std::uint32_t(0x42544C4D) ;  // MLTB
+    static constexpr auto version = std::uint32_t(1) ;
+    static constexpr auto header_size = std::size_t(64) ;
+    static constexpr auto component_size = std::size_t(24) ;
+    static constexpr auto directory_size = std::size_t(16) ;
+    bundle_t(const std::filesystem::path &path) ;
+    // Is the file a bundle (just checks the signature)
+    static auto isBundle(const std::filesystem::path &path) ->bool ;
+    auto size() const ->std::size_t { return count;}
+    auto maxid() const ->std::uint32_t ;
+    // The ids in the bundle, in increasing order
+    auto ids() const ->std::vector<std::uint32_t> ;
+    auto contains(std::uint32_t id) const ->bool { return find(id) != nullptr;}
+    auto housing() const ->byteview_t ;
+    // Empty if the id is not present
+    auto operator[](std::uint32_t id) const ->multi_t ;
+};
+
+#endif /* bundle_hpp */
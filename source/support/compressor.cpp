@@ -0,0 +1,155 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "compressor.hpp"
+
+#include <stdexcept>
+#include <limits>
+
+using namespace std::string_literals;
+
+//=================================================================================
+//  inflater_t
+//=================================================================================
+//=================================================================================
+inflater_t::inflater_t():stream(),initialized(false) {
+}
+//=================================================================================
+inflater_t::~inflater_t() {
+    if (initialized){
+        inflateEnd(&stream);
+    }
+}
+//=================================================================================
+auto inflater_t::decompress(const std::uint8_t *data, std::size_t size, std::uint8_t *output, std::size_t length) ->std::size_t {
+    if ((size > std::numeric_limits<uInt>::max()) || (length > std::numeric_limits<uInt>::max())){
+        throw std::runtime_error("Decompression error, entry too large"s);
+    }
+    // The stream is only set up the first time, after that it is just reset
+    auto status = Z_OK ;
+    if (!initialized){
+        stream.zalloc = Z_NULL ;
+        stream.zfree = Z_NULL ;
+        stream.opaque = Z_NULL ;
+        stream.next_in = Z_NULL ;
+        stream.avail_in = 0 ;
+        status = inflateInit(&stream) ;
+        initialized = (status == Z_OK) ;
+    }
+    else {
+        status = inflateReset(&stream) ;
+    }
+    if (status != Z_OK){
+        throw std::runtime_error("Decompression error"s);
+    }
+    stream.next_in = const_cast<Bytef*>(data) ;
+    stream.avail_in = static_cast<uInt>(size) ;
+    stream.next_out = output ;
+    stream.avail_out = static_cast<uInt>(length) ;
+    status = inflate(&stream, Z_FINISH) ;
+    if (status != Z_STREAM_END){
+        throw std::runtime_error("Decompression error"s);
+    }
+    return length - stream.avail_out ;
+}
+//=================================================================================
+auto inflater_t::local() ->inflater_t& {
+    thread_local auto inflater = inflater_t() ;
+    return inflater ;
+}
+
+//=================================================================================
+//  compressionpolicy_t
+//=================================================================================
+//=================================================================================
+auto compressionpolicy_t::fast() ->compressionpolicy_t {
+    auto rvalue = compressionpolicy_t() ;
+    rvalue.level = Z_BEST_SPEED ;
+    rvalue.rawbelow = 64 ;
+    rvalue.storeraw = true ;
+    return rvalue ;
+}
+//=================================================================================
+auto compressionpolicy_t::small() ->compressionpolicy_t {
+    auto rvalue = compressionpolicy_t() ;
+    rvalue.level = Z_BEST_COMPRESSION ;
+    rvalue.storeraw = true ;
+    return rvalue ;
+}
+//=================================================================================
+auto compressionpolicy_t::preset(const std::string &name) ->compressionpolicy_t {
+    if (name == "default"){
+        return compressionpolicy_t() ;
+    }
+    if (name == "fast"){
+        return fast() ;
+    }
+    if (name == "small"){
+        return small() ;
+    }
+    throw std::runtime_error("Unknown compression (use default, fast or small): "s + name);
+}
+
+//=================================================================================
+//  deflater_t
+//=================================================================================
+//=================================================================================
+deflater_t::deflater_t():stream(),initialized(false),level(Z_DEFAULT_COMPRESSION),strategy(Z_DEFAULT_STRATEGY) {
+}
+//=================================================================================
+deflater_t::~deflater_t() {
+    if (initialized){
+        deflateEnd(&stream);
+    }
+}
+//=================================================================================
+auto deflater_t::compress(const std::uint8_t *data, std::size_t size, std::vector<std::uint8_t> &output, const compressionpolicy_t &policy) ->bool {
+    if (size < policy.rawbelow){
+        output.assign(data, data + size) ;
+        return false ;
+    }
+    if (size > std::numeric_limits<uInt>::max()){
+        throw std::runtime_error("Compression error, entry too large"s);
+    }
+    // The stream is only set up again if the level or strategy changes, otherwise it is
+    // just reset.  Either way it is the same as deflateInit2 (what compress2 uses)
+    auto status = Z_OK ;
+    if (initialized && ((level != policy.level) || (strategy != policy.strategy))){
+        deflateEnd(&stream) ;
+        initialized = false ;
+    }
+    if (!initialized){
+        stream.zalloc = Z_NULL ;
+        stream.zfree = Z_NULL ;
+        stream.opaque = Z_NULL ;
+        status = deflateInit2(&stream, policy.level, Z_DEFLATED, MAX_WBITS, 8, policy.strategy) ;
+        initialized = (status == Z_OK) ;
+        level = policy.level ;
+        strategy = policy.strategy ;
+    }
+    else {
+        status = deflateReset(&stream) ;
+    }
+    if (status != Z_OK){
+        throw std::runtime_error("Compression error"s);
+    }
+    output.resize(deflateBound(&stream, static_cast<uLong>(size))) ;
+    stream.next_in = const_cast<Bytef*>(data) ;
+    stream.avail_in = static_cast<uInt>(size) ;
+    stream.next_out = output.data() ;
+    stream.avail_out = static_cast<uInt>(output.size()) ;
+    status = deflate(&stream, Z_FINISH) ;
+    if (status != Z_STREAM_END){
+        throw std::runtime_error("Compression error"s);
+    }
+    output.resize(output.size() - stream.avail_out) ;
+    if (policy.storeraw && (output.size() >= size)){
+        output.assign(data, data + size) ;
+        return false ;
+    }
+    return true ;
+}
+//=================================================================================
+auto deflater_t::local() ->deflater_t& {
+    thread_local auto deflater = deflater_t() ;
+    return deflater ;
+}
@@ -0,0 +1,79 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef compressor_hpp
+#define compressor_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <zlib.h>
+//=================================================================================
+//  inflater_t ;
+//=================================================================================
+// A zlib decompressor that keeps its z_stream (and the window zlib allocates for it)
+// between uses, it is just reset for each new entry instead of set up and torn down
+// as uncompress2 does.  An inflater_t is not thread safe, local() returns one for the
+// calling thread.
+//=================================================================================
+class inflater_t {
+    z_stream stream ;
+    bool initialized ;
+public:
+    inflater_t() ;
+    inflater_t(const inflater_t&) = delete ;
+    auto operator=(const inflater_t&) ->inflater_t& = delete ;
+    ~inflater_t() ;
+    // Uncompresses size bytes of zlib data into output (of length bytes), returns the
+    // number of bytes produced.  Throws if the data is bad, or does not fit in output
+    auto decompress(const std::uint8_t *data, std::size_t size, std::uint8_t *output, std::size_t length) ->std::size_t ;
+    // The inflater_t for the calling thread
+    static auto local() ->inflater_t& ;
+};
+
+//=================================================================================
+//  compressionpolicy_t ;
+//=================================================================================
+// How entry data is compressed.  The default is exactly what compress() does (so the
+// same bytes), the presets trade size for speed.
+//=================================================================================
+struct compressionpolicy_t {
+    int level ;             // zlib level (0-9, or Z_DEFAULT_COMPRESSION)
+    int strategy ;          // zlib strategy (Z_DEFAULT_STRATEGY, Z_FILTERED, ...)
+    std::size_t rawbelow ;  // data smaller than this is stored raw, without trying zlib
+    bool storeraw ;         // store the data raw if zlib does not make it smaller
+    compressionpolicy_t():level(Z_DEFAULT_COMPRESSION),strategy(Z_DEFAULT_STRATEGY),rawbelow(0),storeraw(false){}
+    // Quickest to build: the fastest level, and small data is not even tried
+    static auto fast() ->compressionpolicy_t ;
+    // Smallest output: the best level, and nothing is stored larger than it is raw
+    static auto small() ->compressionpolicy_t ;
+    // "default", "fast" or "small" (throws for anything else)
+    static auto preset(const std::string &name) ->compressionpolicy_t ;
+};
+
+//=================================================================================
+//  deflater_t ;
+//=================================================================================
+// A zlib compressor that keeps its z_stream between uses (it is reset, rather than set
+// up and torn down as compress2 does), as inflater_t does for decompressing.  A
+// deflater_t is not thread safe, local() returns one for the calling thread.
+//=================================================================================
+class deflater_t {
+    z_stream stream ;
+    bool initialized ;
+    int level ;
+    int strategy ;
+public:
+    deflater_t() ;
+    deflater_t(const deflater_t&) = delete ;
+    auto operator=(const deflater_t&) ->deflater_t& = delete ;
+    ~deflater_t() ;
+    // Compresses size bytes of data into output (sized to fit) as the policy says.
+    // Returns true if output is zlib data, or false if the policy had it stored raw (output
+    // is then a copy of data).  Throws if zlib fails
+    auto compress(const std::uint8_t *data, std::size_t size, std::vector<std::uint8_t> &output, const compressionpolicy_t &policy = compressionpolicy_t()) ->bool ;
+    // The deflater_t for the calling thread
+    static auto local() ->deflater_t& ;
+};
+
+#endif /* compressor_hpp */
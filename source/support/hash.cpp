@@ -5,18 +5,111 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <limits>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HASH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HASH_TARGET(x)
+#else
+#define HASH_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
 
 using namespace std::string_literals;
 
 //=================================================================================
-auto hashLittle2(const std::string &hashstring) ->std::uint64_t {
+// The hash cache file is:
+//		std::uint32_t signature
+//		std::uint32_t version
+//		std::uint32_t startnum
+//		std::uint32_t endnum
+//		std::uint32_t format length
+//		char format[format length]
+//		std::uint32_t count
+//		{ std::uint64_t hash, std::uint32_t entry } [count]
+constexpr auto cache_signature = std::uint32_t(0x4853484D) ;
+constexpr auto cache_version = std::uint32_t(2) ;
+
+//=================================================================================
+// The cpu features we can take advantage of (checked once)
+//=================================================================================
+struct cpufeatures_t {
+	bool sse2 ;
+	bool ssse3 ;
+	bool avx2 ;
+	cpufeatures_t():sse2(false),ssse3(false),avx2(false){
+#if defined(HASH_X86)
+#if defined(_MSC_VER)
+		int info[4] ;
+		__cpuid(info,0) ;
+		auto maxleaf = info[0] ;
+		__cpuid(info,1) ;
+		sse2 = (info[3] & (1<<26)) != 0 ;
+		ssse3 = (info[2] & (1<<9)) != 0 ;
+		// AVX2 needs the os to save the ymm registers as well
+		auto osxsave = (info[2] & (1<<27)) != 0 ;
+		if (osxsave && (maxleaf >= 7) && ((_xgetbv(0) & 0x6) == 0x6)){
+			__cpuidex(info,7,0) ;
+			avx2 = (info[1] & (1<<5)) != 0 ;
+		}
+#else
+		__builtin_cpu_init() ;
+		sse2 = __builtin_cpu_supports("sse2") ;
+		ssse3 = __builtin_cpu_supports("ssse3") ;
+		avx2 = __builtin_cpu_supports("avx2") ;
+#endif
+#endif
+	}
+};
+static auto cpufeatures() ->const cpufeatures_t& {
+	static const auto features = cpufeatures_t() ;
+	return features ;
+}
+
+//=================================================================================
+// hashLittle2
+//=================================================================================
+//=================================================================================
+// hashLittle2 reads its bytes as char, so where char is signed, the bytes above
+// 0x7F are sign extended before they are shifted in.  To give the same results
+// when reading four bytes at a time, we have to make the same adjustment
+// (the sign extension of the top byte is shifted out, so only the lower three matter)
+inline auto adjustWord(std::uint32_t word) ->std::uint32_t {
+	if constexpr (std::numeric_limits<char>::is_signed){
+		return word - ((word & 0x00808080) << 1) ;
+	}
+	else {
+		return word ;
+	}
+}
+//=================================================================================
+// Read up to four bytes as a little endian word (missing bytes are zero)
+inline auto loadWord(const char *data, std::uint32_t amount) ->std::uint32_t {
+	auto word = std::uint32_t(0) ;
+	if (amount >= 4){
+		std::memcpy(&word,data,4) ;
+	}
+	else {
+		for (std::uint32_t j = 0 ; j < amount ; j++){
+			word |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[j])) << (8*j) ;
+		}
+	}
+	return word ;
+}
+
+//=================================================================================
+static auto hashLittle2(const char *hashstring, std::uint32_t length) ->std::uint64_t {
 	auto a = std::uint32_t(0) ;
 	auto b = std::uint32_t(0) ;
 	auto c = std::uint32_t(0) ;
 	
 	auto k = int(0) ;
 	
-	auto length = static_cast<std::uint32_t>(hashstring.size()) ;
 	
 	c = 0xDEADBEEF + static_cast<std::uint32_t>(length) ;
 	a = c;
@@ -108,59 +201,583 @@ auto hashLittle2(const std::string &hashstring) ->std::uint64_t {
 	return (static_cast<std::uint64_t>(b) << 32) | static_cast<std::uint64_t>(c) ;
 
 }
+//=================================================================================
+auto hashLittle2(std::string_view hashstring) ->std::uint64_t {
+	return hashLittle2(hashstring.data(), static_cast<std::uint32_t>(hashstring.size())) ;
+}
+
+#if defined(HASH_X86)
+//=================================================================================
+// The batch kernels. Each lane hashes one key, all keys are the same length, so
+// every lane takes the same path through the hash.  The words for each lane
+// are gathered with plain loads, the mixing is what is done in parallel
+//=================================================================================
+#define ROTL128(x,k) _mm_or_si128(_mm_slli_epi32((x),(k)),_mm_srli_epi32((x),32-(k)))
+#define ROTL256(x,k) _mm256_or_si256(_mm256_slli_epi32((x),(k)),_mm256_srli_epi32((x),32-(k)))
+
+//=================================================================================
+HASH_TARGET("sse2")
+static auto hashLittle2SSE2(const char *keys, std::size_t length, std::size_t count, std::uint64_t *hashes) ->std::size_t {
+	constexpr auto lanes = std::size_t(4) ;
+	auto done = std::size_t(0) ;
+	const auto init = _mm_set1_epi32(static_cast<int>(0xDEADBEEF + static_cast<std::uint32_t>(length))) ;
+	std::uint32_t words[3][lanes] ;
+	std::uint32_t lowb[lanes] ;
+	std::uint32_t lowc[lanes] ;
+	for ( ; done + lanes <= count ; done += lanes){
+		auto a = init ;
+		auto b = init ;
+		auto c = init ;
+		auto base = keys + done * length ;
+		auto remaining = static_cast<std::uint32_t>(length) ;
+		auto k = std::size_t(0) ;
+		while (remaining > 12){
+			for (std::size_t lane = 0 ; lane < lanes ; lane++){
+				auto key = base + lane * length + k ;
+				words[0][lane] = adjustWord(loadWord(key,4)) ;
+				words[1][lane] = adjustWord(loadWord(key+4,4)) ;
+				words[2][lane] = adjustWord(loadWord(key+8,4)) ;
+			}
+			a = _mm_add_epi32(a,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[0]))) ;
+			b = _mm_add_epi32(b,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[1]))) ;
+			c = _mm_add_epi32(c,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[2]))) ;
+			
+			a = _mm_sub_epi32(a,c); a = _mm_xor_si128(a,ROTL128(c,4)); c = _mm_add_epi32(c,b);
+			b = _mm_sub_epi32(b,a); b = _mm_xor_si128(b,ROTL128(a,6)); a = _mm_add_epi32(a,c);
+			c = _mm_sub_epi32(c,b); c = _mm_xor_si128(c,ROTL128(b,8)); b = _mm_add_epi32(b,a);
+			a = _mm_sub_epi32(a,c); a = _mm_xor_si128(a,ROTL128(c,16)); c = _mm_add_epi32(c,b);
+			b = _mm_sub_epi32(b,a); b = _mm_xor_si128(b,ROTL128(a,19)); a = _mm_add_epi32(a,c);
+			c = _mm_sub_epi32(c,b); c = _mm_xor_si128(c,ROTL128(b,4)); b = _mm_add_epi32(b,a);
+			remaining -= 12 ;
+			k += 12 ;
+		}
+		if (remaining != 0){
+			auto amount_a = std::min(remaining,std::uint32_t(4)) ;
+			auto amount_b = remaining > 4 ? std::min(remaining - 4,std::uint32_t(4)) : 0 ;
+			auto amount_c = remaining > 8 ? remaining - 8 : 0 ;
+			for (std::size_t lane = 0 ; lane < lanes ; lane++){
+				auto key = base + lane * length + k ;
+				words[0][lane] = adjustWord(loadWord(key,amount_a)) ;
+				words[1][lane] = adjustWord(loadWord(key+4,amount_b)) ;
+				words[2][lane] = adjustWord(loadWord(key+8,amount_c)) ;
+			}
+			a = _mm_add_epi32(a,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[0]))) ;
+			b = _mm_add_epi32(b,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[1]))) ;
+			c = _mm_add_epi32(c,_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[2]))) ;
+			
+			c = _mm_xor_si128(c,b); c = _mm_sub_epi32(c,ROTL128(b,14));
+			a = _mm_xor_si128(a,c); a = _mm_sub_epi32(a,ROTL128(c,11));
+			b = _mm_xor_si128(b,a); b = _mm_sub_epi32(b,ROTL128(a,25));
+			c = _mm_xor_si128(c,b); c = _mm_sub_epi32(c,ROTL128(b,16));
+			a = _mm_xor_si128(a,c); a = _mm_sub_epi32(a,ROTL128(c,4));
+			b = _mm_xor_si128(b,a); b = _mm_sub_epi32(b,ROTL128(a,14));
+			c = _mm_xor_si128(c,b); c = _mm_sub_epi32(c,ROTL128(b,24));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lowb),b) ;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lowc),c) ;
+		for (std::size_t lane = 0 ; lane < lanes ; lane++){
+			hashes[done + lane] = (static_cast<std::uint64_t>(lowb[lane]) << 32) | static_cast<std::uint64_t>(lowc[lane]) ;
+		}
+	}
+	return done ;
+}
+//=================================================================================
+HASH_TARGET("avx2")
+static auto hashLittle2AVX2(const char *keys, std::size_t length, std::size_t count, std::uint64_t *hashes) ->std::size_t {
+	constexpr auto lanes = std::size_t(8) ;
+	auto done = std::size_t(0) ;
+	const auto init = _mm256_set1_epi32(static_cast<int>(0xDEADBEEF + static_cast<std::uint32_t>(length))) ;
+	std::uint32_t words[3][lanes] ;
+	std::uint32_t lowb[lanes] ;
+	std::uint32_t lowc[lanes] ;
+	for ( ; done + lanes <= count ; done += lanes){
+		auto a = init ;
+		auto b = init ;
+		auto c = init ;
+		auto base = keys + done * length ;
+		auto remaining = static_cast<std::uint32_t>(length) ;
+		auto k = std::size_t(0) ;
+		while (remaining > 12){
+			for (std::size_t lane = 0 ; lane < lanes ; lane++){
+				auto key = base + lane * length + k ;
+				words[0][lane] = adjustWord(loadWord(key,4)) ;
+				words[1][lane] = adjustWord(loadWord(key+4,4)) ;
+				words[2][lane] = adjustWord(loadWord(key+8,4)) ;
+			}
+			a = _mm256_add_epi32(a,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[0]))) ;
+			b = _mm256_add_epi32(b,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[1]))) ;
+			c = _mm256_add_epi32(c,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[2]))) ;
+			
+			a = _mm256_sub_epi32(a,c); a = _mm256_xor_si256(a,ROTL256(c,4)); c = _mm256_add_epi32(c,b);
+			b = _mm256_sub_epi32(b,a); b = _mm256_xor_si256(b,ROTL256(a,6)); a = _mm256_add_epi32(a,c);
+			c = _mm256_sub_epi32(c,b); c = _mm256_xor_si256(c,ROTL256(b,8)); b = _mm256_add_epi32(b,a);
+			a = _mm256_sub_epi32(a,c); a = _mm256_xor_si256(a,ROTL256(c,16)); c = _mm256_add_epi32(c,b);
+			b = _mm256_sub_epi32(b,a); b = _mm256_xor_si256(b,ROTL256(a,19)); a = _mm256_add_epi32(a,c);
+			c = _mm256_sub_epi32(c,b); c = _mm256_xor_si256(c,ROTL256(b,4)); b = _mm256_add_epi32(b,a);
+			remaining -= 12 ;
+			k += 12 ;
+		}
+		if (remaining != 0){
+			auto amount_a = std::min(remaining,std::uint32_t(4)) ;
+			auto amount_b = remaining > 4 ? std::min(remaining - 4,std::uint32_t(4)) : 0 ;
+			auto amount_c = remaining > 8 ? remaining - 8 : 0 ;
+			for (std::size_t lane = 0 ; lane < lanes ; lane++){
+				auto key = base + lane * length + k ;
+				words[0][lane] = adjustWord(loadWord(key,amount_a)) ;
+				words[1][lane] = adjustWord(loadWord(key+4,amount_b)) ;
+				words[2][lane] = adjustWord(loadWord(key+8,amount_c)) ;
+			}
+			a = _mm256_add_epi32(a,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[0]))) ;
+			b = _mm256_add_epi32(b,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[1]))) ;
+			c = _mm256_add_epi32(c,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words[2]))) ;
+			
+			c = _mm256_xor_si256(c,b); c = _mm256_sub_epi32(c,ROTL256(b,14));
+			a = _mm256_xor_si256(a,c); a = _mm256_sub_epi32(a,ROTL256(c,11));
+			b = _mm256_xor_si256(b,a); b = _mm256_sub_epi32(b,ROTL256(a,25));
+			c = _mm256_xor_si256(c,b); c = _mm256_sub_epi32(c,ROTL256(b,16));
+			a = _mm256_xor_si256(a,c); a = _mm256_sub_epi32(a,ROTL256(c,4));
+			b = _mm256_xor_si256(b,a); b = _mm256_sub_epi32(b,ROTL256(a,14));
+			c = _mm256_xor_si256(c,b); c = _mm256_sub_epi32(c,ROTL256(b,24));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lowb),b) ;
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lowc),c) ;
+		for (std::size_t lane = 0 ; lane < lanes ; lane++){
+			hashes[done + lane] = (static_cast<std::uint64_t>(lowb[lane]) << 32) | static_cast<std::uint64_t>(lowc[lane]) ;
+		}
+	}
+	return done ;
+}
+#endif
+
+//=================================================================================
+auto hashLittle2(const char *keys, std::size_t length, std::size_t count, std::uint64_t *hashes) ->void {
+	auto done = std::size_t(0) ;
+#if defined(HASH_X86)
+	if (cpufeatures().avx2){
+		done = hashLittle2AVX2(keys,length,count,hashes) ;
+	}
+	// SSE2 (always there on x86-64, not always on 32 bit x86) picks up what is left
+	// over from AVX2
+	if (cpufeatures().sse2){
+		done += hashLittle2SSE2(keys + done * length,length,count - done,hashes + done) ;
+	}
+#endif
+	// What ever is left (or everything if no simd), is done one at a time
+	for ( ; done < count ; done++){
+		hashes[done] = hashLittle2(keys + done * length, static_cast<std::uint32_t>(length)) ;
+	}
+}
 
 //==================================================================================
-auto hashAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t {
-	std::uint32_t a = 1 ;
-	std::uint32_t b = 0 ;
-	for (const auto &entry : data ) {
-		a = (a + static_cast<std::uint32_t>(entry)) % 0xFFF1;
-		b = (b + a) % 0xFFF1 ;
+// Adler32
+//==================================================================================
+//==================================================================================
+// adler_nmax is the most bytes that can be summed before b can overflow 32 bits,
+// so the modulo is only needed once every adler_nmax bytes, not for every byte
+constexpr auto adler_base = std::uint32_t(0xFFF1) ;
+constexpr auto adler_nmax = std::size_t(5552) ;
+constexpr auto adler_block = std::size_t(32) ;
+
+//==================================================================================
+static auto adler32Scalar(std::uint32_t adler, const std::uint8_t *data, std::size_t size) ->std::uint32_t {
+	auto a = adler & 0xFFFF ;
+	auto b = adler >> 16 ;
+	while (size > 0){
+		auto amount = std::min(size,adler_nmax) ;
+		size -= amount ;
+		while (amount >= 8){
+			a += data[0] ; b += a ;
+			a += data[1] ; b += a ;
+			a += data[2] ; b += a ;
+			a += data[3] ; b += a ;
+			a += data[4] ; b += a ;
+			a += data[5] ; b += a ;
+			a += data[6] ; b += a ;
+			a += data[7] ; b += a ;
+			data += 8 ;
+			amount -= 8 ;
+		}
+		while (amount > 0){
+			a += *data++ ;
+			b += a ;
+			amount-- ;
+		}
+		a %= adler_base ;
+		b %= adler_base ;
 	}
-	return (b<<16)| a ;
+	return (b<<16) | a ;
+}
 
+#if defined(HASH_X86)
+//==================================================================================
+// The simd kernels work on 32 byte blocks, and only do the blocks (the caller does
+// the rest).  For a block, a gains the sum of the bytes, and b gains 32 times a (as
+// it was at the start of the block) plus each byte weighted by 32 down to 1. The
+// weighted sums are done with maddubs/madd, the plain sums with sad against zero.
+//==================================================================================
+HASH_TARGET("ssse3")
+static auto adler32SSSE3(std::uint32_t adler, const std::uint8_t *data, std::size_t blocks) ->std::uint32_t {
+	auto a = adler & 0xFFFF ;
+	auto b = adler >> 16 ;
+	const auto tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17) ;
+	const auto tap2 = _mm_setr_epi8(16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1) ;
+	const auto zero = _mm_setzero_si128() ;
+	const auto ones = _mm_set1_epi16(1) ;
+	while (blocks > 0){
+		auto amount = std::min(blocks,adler_nmax / adler_block) ;
+		blocks -= amount ;
+		// previous sums of a, a itself is added in for every block at the end
+		auto vprev = _mm_set_epi32(0,0,0,static_cast<int>(a * amount)) ;
+		auto vb = _mm_set_epi32(0,0,0,static_cast<int>(b)) ;
+		auto va = _mm_setzero_si128() ;
+		do {
+			const auto bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)) ;
+			const auto bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)) ;
+			vprev = _mm_add_epi32(vprev,va) ;
+			va = _mm_add_epi32(va,_mm_sad_epu8(bytes1,zero)) ;
+			vb = _mm_add_epi32(vb,_mm_madd_epi16(_mm_maddubs_epi16(bytes1,tap1),ones)) ;
+			va = _mm_add_epi32(va,_mm_sad_epu8(bytes2,zero)) ;
+			vb = _mm_add_epi32(vb,_mm_madd_epi16(_mm_maddubs_epi16(bytes2,tap2),ones)) ;
+			data += adler_block ;
+		} while (--amount > 0) ;
+		vb = _mm_add_epi32(vb,_mm_slli_epi32(vprev,5)) ;
+		// Add up the lanes
+		va = _mm_add_epi32(va,_mm_shuffle_epi32(va,_MM_SHUFFLE(2,3,0,1))) ;
+		va = _mm_add_epi32(va,_mm_shuffle_epi32(va,_MM_SHUFFLE(1,0,3,2))) ;
+		vb = _mm_add_epi32(vb,_mm_shuffle_epi32(vb,_MM_SHUFFLE(2,3,0,1))) ;
+		vb = _mm_add_epi32(vb,_mm_shuffle_epi32(vb,_MM_SHUFFLE(1,0,3,2))) ;
+		a = (a + static_cast<std::uint32_t>(_mm_cvtsi128_si32(va))) % adler_base ;
+		b = static_cast<std::uint32_t>(_mm_cvtsi128_si32(vb)) % adler_base ;
+	}
+	return (b<<16) | a ;
+}
+//==================================================================================
+HASH_TARGET("avx2")
+static auto adler32AVX2(std::uint32_t adler, const std::uint8_t *data, std::size_t blocks) ->std::uint32_t {
+	auto a = adler & 0xFFFF ;
+	auto b = adler >> 16 ;
+	const auto tap = _mm256_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1) ;
+	const auto zero = _mm256_setzero_si256() ;
+	const auto ones = _mm256_set1_epi16(1) ;
+	while (blocks > 0){
+		auto amount = std::min(blocks,adler_nmax / adler_block) ;
+		blocks -= amount ;
+		auto vprev = _mm256_set_epi32(0,0,0,0,0,0,0,static_cast<int>(a * amount)) ;
+		auto vb = _mm256_set_epi32(0,0,0,0,0,0,0,static_cast<int>(b)) ;
+		auto va = _mm256_setzero_si256() ;
+		do {
+			const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)) ;
+			vprev = _mm256_add_epi32(vprev,va) ;
+			va = _mm256_add_epi32(va,_mm256_sad_epu8(bytes,zero)) ;
+			vb = _mm256_add_epi32(vb,_mm256_madd_epi16(_mm256_maddubs_epi16(bytes,tap),ones)) ;
+			data += adler_block ;
+		} while (--amount > 0) ;
+		vb = _mm256_add_epi32(vb,_mm256_slli_epi32(vprev,5)) ;
+		// Add up the lanes
+		auto sa = _mm_add_epi32(_mm256_castsi256_si128(va),_mm256_extracti128_si256(va,1)) ;
+		auto sb = _mm_add_epi32(_mm256_castsi256_si128(vb),_mm256_extracti128_si256(vb,1)) ;
+		sa = _mm_add_epi32(sa,_mm_shuffle_epi32(sa,_MM_SHUFFLE(2,3,0,1))) ;
+		sa = _mm_add_epi32(sa,_mm_shuffle_epi32(sa,_MM_SHUFFLE(1,0,3,2))) ;
+		sb = _mm_add_epi32(sb,_mm_shuffle_epi32(sb,_MM_SHUFFLE(2,3,0,1))) ;
+		sb = _mm_add_epi32(sb,_mm_shuffle_epi32(sb,_MM_SHUFFLE(1,0,3,2))) ;
+		a = (a + static_cast<std::uint32_t>(_mm_cvtsi128_si32(sa))) % adler_base ;
+		b = static_cast<std::uint32_t>(_mm_cvtsi128_si32(sb)) % adler_base ;
+	}
+	return (b<<16) | a ;
+}
+#endif
+//==================================================================================
+static auto adler32Update(std::uint32_t adler, const std::uint8_t *data, std::size_t size) ->std::uint32_t {
+#if defined(HASH_X86)
+	auto blocks = size / adler_block ;
+	if (blocks > 0){
+		if (cpufeatures().avx2){
+			adler = adler32AVX2(adler,data,blocks) ;
+			data += blocks * adler_block ;
+			size -= blocks * adler_block ;
+		}
+		else if (cpufeatures().ssse3){
+			adler = adler32SSSE3(adler,data,blocks) ;
+			data += blocks * adler_block ;
+			size -= blocks * adler_block ;
+		}
+	}
+#endif
+	return adler32Scalar(adler,data,size) ;
+}
+//==================================================================================
+auto hashAdler32(const std::uint8_t *data, std::size_t size) ->std::uint32_t {
+	return adler32Update(1,data,size) ;
+}
+//==================================================================================
+auto hashAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t {
+	return adler32Update(1,data.data(),data.size()) ;
 }
 //==================================================================================
 auto hashAdler32(std::iostream &input,std::uint32_t amount) ->std::uint32_t {
-	std::uint32_t a = 1 ;
-	std::uint32_t b = 0 ;
-	auto entry = std::uint8_t(0);
-	for (std::uint32_t j = 0; j<amount ;j++) {
-		input.read(reinterpret_cast<char*>(&entry),sizeof(entry));
-		a = (a + static_cast<std::uint32_t>(entry)) % 0xFFF1;
-		b = (b + a) % 0xFFF1 ;
-	}
-	return (b<<16)| a ;
-
+	constexpr auto chunk_size = std::uint32_t(64 * 1024) ;
+	auto buffer = std::vector<std::uint8_t>(std::min(amount,chunk_size)) ;
+	auto adler = std::uint32_t(1) ;
+	auto last = std::uint8_t(0) ;
+	while (amount > 0){
+		auto size = std::min(amount,chunk_size) ;
+		input.read(reinterpret_cast<char*>(buffer.data()),size);
+		auto got = static_cast<std::uint32_t>(input.gcount()) ;
+		adler = adler32Update(adler,buffer.data(),got) ;
+		amount -= got ;
+		if (got > 0){
+			last = buffer[got-1] ;
+		}
+		if (got < size){
+			// We ran out of data. The byte at a time version kept adding the last
+			// byte it read (or 0) for what was missing, so we do the same
+			std::fill(buffer.begin(),buffer.end(),last) ;
+			while (amount > 0){
+				auto fill = std::min(amount,static_cast<std::uint32_t>(buffer.size())) ;
+				adler = adler32Update(adler,buffer.data(),fill) ;
+				amount -= fill ;
+			}
+		}
+	}
+	return adler ;
+}
+//==================================================================================
+auto formatName(char *buffer, std::size_t size, const char *format, std::uint32_t id) ->std::string_view {
+	auto length = std::snprintf(buffer, size, format, id) ;
+	if ((length < 0) || (static_cast<std::size_t>(length) >= size)){
+		throw std::runtime_error("Error applying format string");
+	}
+	return std::string_view(buffer, static_cast<std::size_t>(length)) ;
+}
+//==================================================================================
+auto hashName(const std::string &format, std::uint32_t id) ->std::uint64_t {
+	char buffer[max_name_size] ;
+	return hashLittle2(formatName(buffer, sizeof(buffer), format.c_str(), id)) ;
 }
 //==================================================================================
 hashset_t::hashset_t(const std::string &format,std::uint32_t startnum,std::uint32_t endnum):hashset_t(){
 	load(format,startnum,endnum);
 }
 //==================================================================================
+// Returns the slot holding the hash, or the empty slot it would go in. There is
+// always an empty slot, as the table is never allowed to be more then half full
+auto hashset_t::locate(std::uint64_t hash) const ->std::size_t {
+	auto mask = slots.size() - 1 ;
+	auto index = static_cast<std::size_t>(hash ^ (hash >> 32)) & mask ;
+	while (slots[index].used && (slots[index].hash != hash)){
+		index = (index + 1) & mask ;
+	}
+	return index ;
+}
+//==================================================================================
+auto hashset_t::rehash(std::size_t capacity) ->void {
+	auto old = std::vector<slot_t>(capacity,slot_t{0,0,false}) ;
+	std::swap(old,slots);
+	for (const auto &slot : old){
+		if (slot.used){
+			slots[locate(slot.hash)] = slot ;
+		}
+	}
+}
+//==================================================================================
 auto hashset_t::clear() ->void {
-	hashes.clear() ;
+	slots.clear() ;
+	count = 0 ;
+}
+//==================================================================================
+auto hashset_t::reserve(std::size_t amount) ->void {
+	auto capacity = std::size_t(16) ;
+	while (capacity < amount * 2){
+		capacity <<= 1 ;
+	}
+	if (capacity > slots.size()){
+		rehash(capacity);
+	}
 }
 //==================================================================================
 auto hashset_t::load(const std::string &format,std::uint32_t startnum,std::uint32_t endnum) ->void {
+	if (endnum < startnum){
+		return ;
+	}
+	auto amount = static_cast<std::size_t>(endnum - startnum) + 1 ;
+	reserve(count + amount) ;
+	// Format all the names one after another, if they are the same length (the
+	// normal case, with a fixed width id) they can be hashed as a batch
+	char buffer[max_name_size] ;
+	auto names = std::string() ;
+	auto length = std::size_t(0) ;
+	auto samelength = true ;
 	for (std::uint32_t entry = startnum; entry <= endnum;entry+=1){
-		auto hashformat = applyformat(format,entry) ;
-		hashes.insert_or_assign(hashLittle2(hashformat),entry);
+		auto name = formatName(buffer, sizeof(buffer), format.c_str(), entry) ;
+		if (entry == startnum){
+			length = name.size() ;
+			names.reserve(length * amount) ;
+		}
+		samelength = samelength && (name.size() == length) ;
+		if (!samelength){
+			break;
+		}
+		names.append(name) ;
+		if (entry == endnum){
+			break;	// endnum may be the largest std::uint32_t
+		}
+	}
+	if (samelength){
+		auto hashes = std::vector<std::uint64_t>(amount) ;
+		hashLittle2(names.data(),length,amount,hashes.data()) ;
+		for (std::size_t j = 0 ; j < amount ; j++){
+			insert(hashes[j],startnum + static_cast<std::uint32_t>(j));
+		}
+	}
+	else {
+		for (std::uint32_t entry = startnum; entry <= endnum;entry+=1){
+			insert(hashLittle2(formatName(buffer, sizeof(buffer), format.c_str(), entry)),entry);
+			if (entry == endnum){
+				break;
+			}
+		}
 	}
 }
 //==================================================================================
 auto hashset_t::size() const ->size_t {
-	return hashes.size();
+	return count;
 }
 //==================================================================================
 auto hashset_t::insert(std::uint64_t hash, std::uint32_t entry) ->void {
-	hashes.insert_or_assign(hash,entry);
+	if ((count + 1) * 2 > slots.size()){
+		reserve(count + 1) ;
+	}
+	auto &slot = slots[locate(hash)] ;
+	if (!slot.used){
+		slot.used = true ;
+		slot.hash = hash ;
+		count++ ;
+	}
+	slot.entry = entry ;
+}
+//==================================================================================
+auto hashset_t::find(std::uint64_t hash) const ->const std::uint32_t* {
+	if (count == 0){
+		return nullptr ;
+	}
+	const auto &slot = slots[locate(hash)] ;
+	return slot.used ? &slot.entry : nullptr ;
 }
 //==================================================================================
 auto hashset_t::operator[](std::uint64_t hash) const -> const std::uint32_t& {
-	return hashes.at(hash) ;
+	auto entry = find(hash) ;
+	if (entry == nullptr){
+		throw std::out_of_range("Hash not in hashset");
+	}
+	return *entry ;
 }
 //==================================================================================
 auto hashset_t::operator[](std::uint64_t hash)  ->  std::uint32_t& {
-	return hashes.at(hash) ;
+	return const_cast<std::uint32_t&>(static_cast<const hashset_t&>(*this)[hash]) ;
+}
+//==================================================================================
+auto hashset_t::load(const std::string &format,std::uint32_t startnum,std::uint32_t endnum,const std::filesystem::path &cachepath) ->void {
+	if (!loadCache(cachepath,format,startnum,endnum)){
+		load(format,startnum,endnum);
+		saveCache(cachepath,format,startnum,endnum);
+	}
+}
+//==================================================================================
+auto hashset_t::loadCache(const std::filesystem::path &cachepath,const std::string &format,std::uint32_t startnum,std::uint32_t endnum) ->bool {
+	if (endnum < startnum){
+		return false ;
+	}
+	auto input = std::ifstream(cachepath.string(),std::ios::binary);
+	if (!input.is_open()){
+		return false ;
+	}
+	// Check the header matches what we want
+	std::uint32_t header[5] ;
+	input.read(reinterpret_cast<char*>(header),sizeof(header));
+	if (!input.good() || (header[0] != cache_signature) || (header[1] != cache_version) || (header[2] != startnum) || (header[3] != endnum) || (header[4] != format.size())){
+		return false ;
+	}
+	auto text = std::string(header[4],0) ;
+	input.read(text.data(),text.size());
+	auto amount = std::uint32_t(0) ;
+	auto checksum = std::uint64_t(0) ;
+	input.read(reinterpret_cast<char*>(&amount),sizeof(amount));
+	input.read(reinterpret_cast<char*>(&checksum),sizeof(checksum));
+	// Every id in the range has its entry, so there is exactly one record for each
+	if (!input.good() || (text != format) || (amount != (endnum - startnum) + 1)){
+		return false ;
+	}
+	// Now the entries, in one read
+	constexpr auto record_size = sizeof(std::uint64_t) + sizeof(std::uint32_t) ;
+	auto buffer = std::vector<std::uint8_t>(static_cast<std::size_t>(amount) * record_size) ;
+	input.read(reinterpret_cast<char*>(buffer.data()),buffer.size());
+	if ((input.gcount() != static_cast<std::streamsize>(buffer.size())) || (input.peek() != std::ifstream::traits_type::eof())){
+		return false ;
+	}
+	// Every record is covered by the checksum, so a damaged file is never used
+	if (hashLittle2(std::string_view(reinterpret_cast<const char*>(buffer.data()),buffer.size())) != checksum){
+		return false ;
+	}
+	clear();
+	reserve(amount);
+	auto hash = std::uint64_t(0) ;
+	auto entry = std::uint32_t(0) ;
+	for (auto ptr = buffer.data() ; ptr < buffer.data() + buffer.size() ; ptr += record_size){
+		std::copy(ptr,ptr+8,reinterpret_cast<std::uint8_t*>(&hash));
+		std::copy(ptr+8,ptr+record_size,reinterpret_cast<std::uint8_t*>(&entry));
+		if ((entry < startnum) || (entry > endnum)){
+			clear();
+			return false ;
+		}
+		insert(hash,entry);
+	}
+	if (count != amount){
+		clear();
+		return false ;
+	}
+	return true ;
+}
+//==================================================================================
+auto hashset_t::saveCache(const std::filesystem::path &cachepath,const std::string &format,std::uint32_t startnum,std::uint32_t endnum) const ->bool {
+	constexpr auto record_size = sizeof(std::uint64_t) + sizeof(std::uint32_t) ;
+	auto buffer = std::vector<std::uint8_t>(count * record_size) ;
+	auto ptr = buffer.data() ;
+	for (const auto &slot:slots){
+		if (slot.used){
+			std::copy(reinterpret_cast<const std::uint8_t*>(&slot.hash),reinterpret_cast<const std::uint8_t*>(&slot.hash)+8,ptr);
+			std::copy(reinterpret_cast<const std::uint8_t*>(&slot.entry),reinterpret_cast<const std::uint8_t*>(&slot.entry)+4,ptr+8);
+			ptr += record_size ;
+		}
+	}
+	auto checksum = hashLittle2(std::string_view(reinterpret_cast<const char*>(buffer.data()),buffer.size())) ;
+	// Write to a temporary of our own and rename it, so no one ever reads a partial cache
+	auto temppath = cachepath ;
+	temppath += ".tmp"s + std::to_string(std::random_device()()) ;
+	{
+		auto output = std::ofstream(temppath.string(),std::ios::binary);
+		if (!output.is_open()){
+			return false ;
+		}
+		std::uint32_t header[5] = {cache_signature,cache_version,startnum,endnum,static_cast<std::uint32_t>(format.size())} ;
+		output.write(reinterpret_cast<const char*>(header),sizeof(header));
+		output.write(format.data(),format.size());
+		auto amount = static_cast<std::uint32_t>(count) ;
+		output.write(reinterpret_cast<const char*>(&amount),sizeof(amount));
+		output.write(reinterpret_cast<const char*>(&checksum),sizeof(checksum));
+		output.write(reinterpret_cast<const char*>(buffer.data()),buffer.size());
+		output.flush();
+		if (!output.good()){
+			output.close();
+			auto ec = std::error_code() ;
+			std::filesystem::remove(temppath,ec);
+			return false ;
+		}
+	}
+	auto ec = std::error_code() ;
+	std::filesystem::rename(temppath,cachepath,ec);
+	if (ec){
+		std::filesystem::remove(temppath,ec);
+		return false ;
+	}
+	return true ;
 }
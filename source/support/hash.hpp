@@ -10,8 +10,16 @@
 #include <memory>
 #include <algorithm>
 #include <stdexcept>
+#include <filesystem>
+#include <string_view>
+#include <cstdio>
 //=================================================================================
-auto hashLittle2(const std::string &hashstring) ->std::uint64_t;
+auto hashLittle2(std::string_view hashstring) ->std::uint64_t;
+// Hashes count keys, each length bytes, stored one after another in keys.  The keys
+// are hashed in parallel (AVX2/SSE2 when the cpu has them), the results are the same
+// as hashLittle2 on each key
+auto hashLittle2(const char *keys, std::size_t length, std::size_t count, std::uint64_t *hashes) ->void;
+auto hashAdler32(const std::uint8_t *data, std::size_t size) ->std::uint32_t;
 auto hashAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t;
 auto hashAdler32(std::iostream &input,std::uint32_t amount) ->std::uint32_t;
 
@@ -46,16 +54,47 @@ std::string applyformat( const std::string& format_str, Args ... args )
 	
 }
 
+//==================================================================================
+// Hash names are a printf style pattern with a single id (build/multicollection/%.6u.bin).
+// These format them into a caller (or stack) buffer, so there are no allocations.
+// formatName returns a view of the name in buffer, and throws if it doesn't fit
+constexpr auto max_name_size = std::size_t(256) ;
+auto formatName(char *buffer, std::size_t size, const char *format, std::uint32_t id) ->std::string_view ;
+auto hashName(const std::string &format, std::uint32_t id) ->std::uint64_t ;
+
 //========================================================================================
+// A flat (open addressing, linear probing) table of hashes to entry numbers.  Lookups
+// are a probe or two into one array, and a miss does not throw (use find).
 class hashset_t {
-	std::map<std::uint64_t,std::uint32_t> hashes ;
+	struct slot_t {
+		std::uint64_t hash ;
+		std::uint32_t entry ;
+		bool used ;
+	};
+	std::vector<slot_t> slots ;
+	std::size_t count ;
+	auto locate(std::uint64_t hash) const ->std::size_t ;
+	auto rehash(std::size_t capacity) ->void ;
 public:
 	hashset_t(const std::string &format,std::uint32_t startnum,std::uint32_t endnum);
-	hashset_t() = default;
+	hashset_t():count(0){}
 	auto clear() ->void ;
+	// Make room for amount hashes, so they can be inserted without rehashing
+	auto reserve(std::size_t amount) ->void ;
 	auto load(const std::string &format,std::uint32_t startnum,std::uint32_t endnum) ->void ;
+	// Same as above, but first tries the cache at cachepath (see loadCache).  If it is missing
+	// or not valid, the hashes are built and the cache is written there
+	auto load(const std::string &format,std::uint32_t startnum,std::uint32_t endnum,const std::filesystem::path &cachepath) ->void ;
+	// Reads the hashes for this format and range from a file written by saveCache.  False (and
+	// nothing loaded) if it is missing, for another format or range, or fails its checksum
+	auto loadCache(const std::filesystem::path &cachepath,const std::string &format,std::uint32_t startnum,std::uint32_t endnum) ->bool ;
+	// Only written when a caller asks, to a path of its choosing
+	auto saveCache(const std::filesystem::path &cachepath,const std::string &format,std::uint32_t startnum,std::uint32_t endnum) const ->bool ;
 	auto size() const ->size_t ;
 	auto insert(std::uint64_t hash, std::uint32_t entry) ->void ;
+	// Returns nullptr if the hash is not in the set
+	auto find(std::uint64_t hash) const ->const std::uint32_t* ;
+	// These throw std::out_of_range if the hash is not in the set
 	auto operator[](std::uint64_t hash) const -> const std::uint32_t& ;
 	auto operator[](std::uint64_t hash)  ->  std::uint32_t& ;
 
@@ -0,0 +1,125 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "manifest.hpp"
+#include "mapfile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+using namespace std::string_literals;
+
+//=================================================================================
+//  manifestrecord_t
+//=================================================================================
+//=================================================================================
+auto manifestrecord_t::stamp(const std::filesystem::path &path) ->manifestrecord_t {
+    auto rvalue = manifestrecord_t() ;
+    auto error = std::error_code() ;
+    auto size = std::filesystem::file_size(path, error) ;
+    if (error){
+        throw std::runtime_error("Unable to open: "s + path.string());
+    }
+    auto time = std::filesystem::last_write_time(path, error) ;
+    if (error){
+        throw std::runtime_error("Unable to open: "s + path.string());
+    }
+    rvalue.size = static_cast<std::uint64_t>(size) ;
+    rvalue.time = static_cast<std::int64_t>(time.time_since_epoch().count()) ;
+    return rvalue ;
+}
+
+//=================================================================================
+//  manifest_t
+//=================================================================================
+//=================================================================================
+auto manifest_t::manifestPath(const std::filesystem::path &output) ->std::filesystem::path {
+    auto rvalue = output ;
+    rvalue += ".manifest" ;
+    return rvalue ;
+}
+//=================================================================================
+auto manifest_t::temporaryPath(const std::filesystem::path &output) ->std::filesystem::path {
+    auto rvalue = output ;
+    rvalue += ".tmp" ;
+    return rvalue ;
+}
+//=================================================================================
+auto manifest_t::load(const std::filesystem::path &output) ->bool {
+    records.clear() ;
+    auto input = std::ifstream(manifestPath(output).string(),std::ios::binary) ;
+    if (!input.is_open() || !std::filesystem::exists(output)){
+        return false ;
+    }
+    auto data = std::vector<std::uint8_t>(std::istreambuf_iterator<char>(input),std::istreambuf_iterator<char>()) ;
+    if ((data.size() < header_size) || (readValue<std::uint32_t>(data.data()) != signature) || (readValue<std::uint32_t>(data.data()+4) != version)){
+        return false ;
+    }
+    auto count = static_cast<std::size_t>(readValue<std::uint32_t>(data.data()+8)) ;
+    if ((data.size() != header_size + count * record_size) || (readValue<std::uint32_t>(data.data()+12) != settings)){
+        return false ;
+    }
+    // If the output is not as the manifest left it, the table entries mean nothing
+    auto current = manifestrecord_t::stamp(output) ;
+    if ((current.size != readValue<std::uint64_t>(data.data()+16)) || (current.time != readValue<std::int64_t>(data.data()+24))){
+        return false ;
+    }
+    for (std::size_t j = 0 ; j < count ; j++){
+        auto ptr = data.data() + header_size + j * record_size ;
+        auto record = manifestrecord_t() ;
+        record.size = readValue<std::uint64_t>(ptr+4) ;
+        record.time = readValue<std::int64_t>(ptr+12) ;
+        record.hash = readValue<std::uint64_t>(ptr+20) ;
+        record.entry.load(ptr+28) ;
+        records.insert_or_assign(readValue<std::uint32_t>(ptr), record) ;
+    }
+    return true ;
+}
+//=================================================================================
+auto manifest_t::save(const std::filesystem::path &output) const ->void {
+    auto current = manifestrecord_t::stamp(output) ;
+    auto data = std::vector<std::uint8_t>(header_size + records.size() * record_size,0) ;
+    writeValue(data.data(),signature) ;
+    writeValue(data.data()+4,version) ;
+    writeValue(data.data()+8,static_cast<std::uint32_t>(records.size())) ;
+    writeValue(data.data()+12,settings) ;
+    writeValue(data.data()+16,current.size) ;
+    writeValue(data.data()+24,current.time) ;
+    auto ptr = data.data() + header_size ;
+    for (const auto &[id,record] : records){
+        writeValue(ptr,id) ;
+        writeValue(ptr+4,record.size) ;
+        writeValue(ptr+12,record.time) ;
+        writeValue(ptr+20,record.hash) ;
+        record.entry.save(ptr+28) ;
+        ptr += record_size ;
+    }
+    // Written aside and then renamed, so a manifest is never left half written
+    auto path = manifestPath(output) ;
+    auto temporary = temporaryPath(path) ;
+    {
+        auto stream = std::ofstream(temporary.string(),std::ios::binary) ;
+        if (!stream.is_open()){
+            throw std::runtime_error("Unable to create: "s + temporary.string());
+        }
+        stream.write(reinterpret_cast<const char*>(data.data()),data.size()) ;
+        if (!stream.good()){
+            throw std::runtime_error("Unable to write: "s + temporary.string());
+        }
+    }
+    std::filesystem::rename(temporary, path) ;
+}
+//=================================================================================
+auto manifest_t::find(std::uint32_t id) const ->const manifestrecord_t* {
+    auto iter = records.find(id) ;
+    if (iter == records.end()){
+        return nullptr ;
+    }
+    return &iter->second ;
+}
+//=================================================================================
+auto manifest_t::insert(std::uint32_t id, const manifestrecord_t &record) ->void {
+    records.insert_or_assign(id, record) ;
+}
@@ -0,0 +1,78 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef manifest_hpp
+#define manifest_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <filesystem>
+
+#include "uop.hpp"
+//=================================================================================
+// A manifest is kept next to an output created from a csv directory (as
+// <output>.manifest).  For each entry it records the source (the csv, or housing.bin)
+// size, modification time and content hash, and the table entry of its block in the
+// output.  The next create can then copy the block of a source that has not changed
+// straight from the previous output, rather than parsing and compressing it again.
+//
+// Format (little endian):
+//  header (32 bytes)
+//      std::uint32_t   signature ("MLTM")
+//      std::uint32_t   version
+//      std::uint32_t   number of records
+//      std::uint32_t   settings the blocks were made with (only reused with the same)
+//      std::uint64_t   size of the output
+//      std::int64_t    modification time of the output
+//  records, sorted by id (62 bytes each)
+//      std::uint32_t   id (housingid for housing.bin)
+//      std::uint64_t   size of the source
+//      std::int64_t    modification time of the source
+//      std::uint64_t   hash of the source contents (hashLittle2)
+//      table_entry     (34 bytes, as in a uop table, the mul offset and length for a mul)
+//=================================================================================
+
+//=================================================================================
+//  manifestrecord_t ;
+//=================================================================================
+struct manifestrecord_t {
+    std::uint64_t size ;
+    std::int64_t time ;
+    std::uint64_t hash ;
+    table_entry entry ;
+    manifestrecord_t():size(0),time(0),hash(0){}
+    // The size and modification time of a file (the hash is left 0), throws if the
+    // file does not exist
+    static auto stamp(const std::filesystem::path &path) ->manifestrecord_t ;
+};
+
+//=================================================================================
+//  manifest_t ;
+//=================================================================================
+class manifest_t {
+    std::map<std::uint32_t,manifestrecord_t> records ;
+    std::uint32_t settings ;
+public:
+    static constexpr auto signature = std::uint32_t(0x4D544C4D) ;  // MLTM
+    static constexpr auto version = std::uint32_t(1) ;
+    static constexpr auto header_size = std::size_t(32) ;
+    static constexpr auto record_size = std::size_t(28 + table_entry::entry_size) ;
+    // Where the manifest for an output is kept
+    static auto manifestPath(const std::filesystem::path &output) ->std::filesystem::path ;
+    // Where an output (or its manifest) is written, before it replaces the old one
+    static auto temporaryPath(const std::filesystem::path &output) ->std::filesystem::path ;
+    // settings is whatever (other than the sources) decides the contents of the blocks,
+    // the blocks are only of use to a create with the same settings
+    manifest_t(std::uint32_t settings = 0):settings(settings){}
+    // Loads the manifest of output.  False (and empty) if there is none, it is not
+    // valid, it is for other settings, or the output has been changed since it was written
+    auto load(const std::filesystem::path &output) ->bool ;
+    // Writes the manifest of output (which must be complete), replacing any old one
+    auto save(const std::filesystem::path &output) const ->void ;
+    auto find(std::uint32_t id) const ->const manifestrecord_t* ;
+    auto insert(std::uint32_t id, const manifestrecord_t &record) ->void ;
+    auto size() const ->std::size_t { return records.size();}
+    auto clear() ->void { records.clear();}
+};
+
+#endif /* manifest_hpp */
@@ -0,0 +1,171 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "mapfile.hpp"
+
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_literals;
+
+//=================================================================================
+mappedfile_t::mappedfile_t():ptr(nullptr),length(0),isopen(false){
+}
+//=================================================================================
+mappedfile_t::mappedfile_t(const std::filesystem::path &path):mappedfile_t(){
+    open(path);
+}
+//=================================================================================
+mappedfile_t::mappedfile_t(mappedfile_t &&value) noexcept :ptr(value.ptr),length(value.length),isopen(value.isopen){
+    value.ptr = nullptr ;
+    value.length = 0 ;
+    value.isopen = false ;
+}
+//=================================================================================
+auto mappedfile_t::operator=(mappedfile_t &&value) noexcept ->mappedfile_t& {
+    if (this != &value){
+        close();
+        std::swap(ptr,value.ptr);
+        std::swap(length,value.length);
+        std::swap(isopen,value.isopen);
+    }
+    return *this ;
+}
+//=================================================================================
+mappedfile_t::~mappedfile_t(){
+    close();
+}
+//=================================================================================
+// Once the view is mapped, we have no need for the file (or mapping) handles,
+// the view keeps the mapping alive until it is unmapped.
+auto mappedfile_t::open(const std::filesystem::path &path) ->bool {
+    close();
+#if defined(_WIN32)
+    auto file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE){
+        return false ;
+    }
+    auto filesize = LARGE_INTEGER() ;
+    if (!GetFileSizeEx(file, &filesize)){
+        CloseHandle(file);
+        return false ;
+    }
+    length = static_cast<std::size_t>(filesize.QuadPart) ;
+    if (length > 0){
+        auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr){
+            CloseHandle(file);
+            length = 0 ;
+            return false ;
+        }
+        ptr = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (ptr == nullptr){
+            CloseHandle(file);
+            length = 0 ;
+            return false ;
+        }
+    }
+    CloseHandle(file);
+#else
+    auto descriptor = ::open(path.string().c_str(), O_RDONLY);
+    if (descriptor < 0){
+        return false ;
+    }
+    struct stat status ;
+    if (::fstat(descriptor, &status) != 0){
+        ::close(descriptor);
+        return false ;
+    }
+    length = static_cast<std::size_t>(status.st_size) ;
+    if (length > 0){
+        auto address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+        if (address == MAP_FAILED){
+            ::close(descriptor);
+            length = 0 ;
+            return false ;
+        }
+        ptr = static_cast<const std::uint8_t*>(address);
+    }
+    ::close(descriptor);
+#endif
+    // An empty file is "open", it just has nothing in it (you can not map zero bytes)
+    isopen = true ;
+    return true ;
+}
+//=================================================================================
+auto mappedfile_t::close() ->void {
+    if (ptr != nullptr){
+#if defined(_WIN32)
+        UnmapViewOfFile(ptr);
+#else
+        ::munmap(const_cast<std::uint8_t*>(ptr), length);
+#endif
+    }
+    ptr = nullptr ;
+    length = 0 ;
+    isopen = false ;
+}
+//=================================================================================
+auto mappedfile_t::view(std::uint64_t offset, std::uint64_t amount) const ->byteview_t {
+    if ((offset > length) || (amount > length - offset)){
+        throw std::runtime_error("Requested data extends past the end of the file"s);
+    }
+    return byteview_t(ptr + offset, static_cast<std::size_t>(amount));
+}
+//=================================================================================
+auto mappedfile_t::advise(access_t access) const ->void {
+#if !defined(_WIN32)
+    if (ptr != nullptr){
+        auto advice = MADV_NORMAL ;
+        switch (access){
+            case access_t::sequential:
+                advice = MADV_SEQUENTIAL ;
+                break;
+            case access_t::random:
+                advice = MADV_RANDOM ;
+                break;
+            default:
+                break;
+        }
+        ::madvise(const_cast<std::uint8_t*>(ptr), length, advice);
+    }
+#else
+    static_cast<void>(access) ;
+#endif
+}
+//=================================================================================
+auto mappedfile_t::prefetch(std::uint64_t offset, std::uint64_t amount) const ->void {
+    if ((ptr == nullptr) || (offset >= length)){
+        return ;
+    }
+    amount = std::min<std::uint64_t>(amount, length - offset) ;
+#if defined(_WIN32)
+#if defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+    auto range = WIN32_MEMORY_RANGE_ENTRY() ;
+    range.VirtualAddress = const_cast<std::uint8_t*>(ptr + offset) ;
+    range.NumberOfBytes = static_cast<SIZE_T>(amount) ;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    // madvise wants a page aligned address
+    static const auto pagesize = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE)) ;
+    auto start = offset - (offset % pagesize) ;
+    ::madvise(const_cast<std::uint8_t*>(ptr + start), static_cast<std::size_t>(amount + (offset - start)), MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,72 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef mapfile_hpp
+#define mapfile_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <algorithm>
+//=================================================================================
+// A non owning view of a range of bytes (think of it as a span).  It is only valid
+// as long as whatever owns the bytes is.
+//=================================================================================
+struct byteview_t {
+    const std::uint8_t *data ;
+    std::size_t size ;
+    byteview_t():data(nullptr),size(0){}
+    byteview_t(const std::uint8_t *data,std::size_t size):data(data),size(size){}
+    auto empty() const ->bool { return size == 0;}
+    auto begin() const ->const std::uint8_t* { return data;}
+    auto end() const ->const std::uint8_t* { return data + size;}
+};
+//=================================================================================
+// A value read from (or written to) bytes in the file's (little endian) order, the
+// bytes need not be aligned
+template <typename T>
+inline auto readValue(const std::uint8_t *data) ->T {
+    auto rvalue = T(0) ;
+    std::copy(data,data+sizeof(T),reinterpret_cast<std::uint8_t*>(&rvalue));
+    return rvalue ;
+}
+//=================================================================================
+template <typename T>
+inline auto writeValue(std::uint8_t *data, T value) ->void {
+    std::copy(reinterpret_cast<const std::uint8_t*>(&value),reinterpret_cast<const std::uint8_t*>(&value)+sizeof(T),data);
+}
+
+//=================================================================================
+//  mappedfile_t ;
+//=================================================================================
+// A read only memory mapping of an entire file.  Nothing in the mapping is ever
+// modified, so any number of threads may read from it at the same time.
+//=================================================================================
+class mappedfile_t {
+    const std::uint8_t *ptr ;
+    std::size_t length ;
+    bool isopen ;
+public:
+    mappedfile_t() ;
+    mappedfile_t(const std::filesystem::path &path) ;
+    mappedfile_t(const mappedfile_t&) = delete ;
+    auto operator=(const mappedfile_t&) ->mappedfile_t& = delete ;
+    mappedfile_t(mappedfile_t &&value) noexcept ;
+    auto operator=(mappedfile_t &&value) noexcept ->mappedfile_t& ;
+    ~mappedfile_t() ;
+
+    auto open(const std::filesystem::path &path) ->bool ;
+    auto close() ->void ;
+    auto is_open() const ->bool { return isopen;}
+    auto data() const ->const std::uint8_t* { return ptr;}
+    auto size() const ->std::size_t { return length;}
+    // Returns the bytes at offset, throws if the range is not inside the file
+    auto view(std::uint64_t offset, std::uint64_t amount) const ->byteview_t ;
+    // Hints to the os on how the mapping will be read, they change nothing else (and
+    // are ignored where not supported)
+    enum class access_t { normal, sequential, random };
+    auto advise(access_t access) const ->void ;
+    // Start reading the range in (clipped to the file) ahead of when it is needed
+    auto prefetch(std::uint64_t offset, std::uint64_t amount) const ->void ;
+};
+
+#endif /* mapfile_hpp */
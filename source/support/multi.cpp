@@ -7,16 +7,483 @@
 #include <fstream>
 #include <stdexcept>
 #include <zlib.h>
-#include <sstream>
+#include <functional>
+#include <array>
+#include <charconv>
+#include <cctype>
+#include <string_view>
 
 #include "strutil.hpp"
 #include "hash.hpp"
+#include "parallel.hpp"
+#include "compressor.hpp"
+#include "bundle.hpp"
+#include "manifest.hpp"
 
 
 using namespace std::string_literals;
 constexpr auto housinghash = 0x126D1E99DDEDEE0ALL ;
+constexpr auto housingid = std::uint32_t(0xFFFFFFFE) ;
 constexpr auto idxmax = 8480 ;
 const std::string hashformat = "build/multicollection/%.6u.bin"s;
+
+//=================================================================================
+// Where the multi hashes are cached between runs (empty for no cache), see
+// multistorage_t::hashCache
+static auto multiHashCache() ->std::filesystem::path& {
+    static auto cachepath = std::filesystem::path() ;
+    return cachepath ;
+}
+//=================================================================================
+// The hashes for the multi ids never change, so they are only made once a process,
+// read from the cache if there is one (and it is valid), and built otherwise
+static auto multiHashes() ->const hashset_t& {
+    static const auto hashes = [](){
+        auto rvalue = hashset_t() ;
+        const auto &cachepath = multiHashCache() ;
+        if (cachepath.empty()){
+            rvalue.load(hashformat,0,0x10000) ;
+        }
+        else {
+            rvalue.load(hashformat,0,0x10000,cachepath) ;
+        }
+        // Now add the hashstring for housing.bin
+        rvalue.insert(housinghash,housingid) ;
+        return rvalue ;
+    }();
+    return hashes ;
+}
+//=================================================================================
+// Returns the data for an entry, uncompressing it if needed
+static auto entryData(const entrylocation_t &entry, const byteview_t &bytes, std::vector<std::uint8_t> &data) ->void {
+    if (!entry.compression){
+        data.assign(bytes.begin(),bytes.end()) ;
+        return ;
+    }
+    // uncompress the data!
+    data.resize(entry.decompressed_length) ;
+    auto amount = inflater_t::local().decompress(bytes.data, bytes.size, data.data(), data.size()) ;
+    // Should the entry be shorter than it claims, the rest is zero (as it always was)
+    std::fill(data.begin() + amount, data.end(), std::uint8_t(0)) ;
+}
+//=================================================================================
+static auto entryData(const entrylocation_t &entry, const byteview_t &bytes) ->std::vector<std::uint8_t> {
+    auto data = std::vector<std::uint8_t>() ;
+    entryData(entry, bytes, data) ;
+    return data ;
+}
+//=================================================================================
+// The mul flag for a uop flag
+static auto uopFlag(std::uint16_t lflag) ->std::uint64_t {
+    switch (lflag) {
+        default:
+        case 0:
+            return 1 ;
+        case 256:
+            return 0x0000000100000001;
+        case 257:
+            return 0x0000000100000000;
+        case 1:
+            return 0 ;
+    }
+}
+//=================================================================================
+// An entry ready to go in a uop, its compressed data and table entry (the offset
+// is filled in when it is written)
+struct uopblock_t {
+    table_entry entry ;
+    std::vector<std::uint8_t> data ;
+};
+//=================================================================================
+// Compress the data for an id (or housingid) as the policy says (the default is the
+// same as compress), and fill in its table entry
+static auto makeBlock(std::uint32_t id, const std::vector<std::uint8_t> &data, const compressionpolicy_t &policy = compressionpolicy_t()) ->uopblock_t {
+    auto rvalue = uopblock_t() ;
+    rvalue.entry.decompressed_length = static_cast<std::uint32_t>(data.size()) ;
+    try {
+        rvalue.entry.compression = deflater_t::local().compress(data.data(), data.size(), rvalue.data, policy) ? 1 : 0 ;
+    }
+    catch (const std::exception &) {
+        if (id == housingid){
+            throw std::runtime_error("Error compressing data for housing entry"s );
+        }
+        throw std::runtime_error("Error compressing data for entry: "s + std::to_string(id));
+    }
+    rvalue.entry.compressed_length = static_cast<std::uint32_t>(rvalue.data.size());
+    rvalue.entry.identifier = (id == housingid) ? housinghash : hashName(hashformat,id) ;
+    rvalue.entry.data_block_hash = hashAdler32(rvalue.data);
+    return rvalue ;
+}
+//=================================================================================
+// Makes the blocks for a uop, compressed as the options say.  With dedup, each distinct
+// record is only compressed once, a record the same as one already made gets a copy of
+// that block (with its own identifier), which the uopwriter_t (also with dedup) then
+// only writes once.  Only the blocks are kept, a possible match is confirmed against
+// the block expanded again.  Safe to use from any number of threads
+//=================================================================================
+class blockmaker_t {
+    uopoptions_t options ;
+    std::mutex lock ;
+    // The blocks made, by the hash of their record
+    std::unordered_multimap<std::uint64_t,uopblock_t> made ;
+    // Is block what data was made into
+    static auto matches(const uopblock_t &block, const std::vector<std::uint8_t> &data) ->bool {
+        if (block.entry.decompressed_length != data.size()){
+            return false ;
+        }
+        if (!block.entry.compression){
+            return block.data == data ;
+        }
+        thread_local auto scratch = std::vector<std::uint8_t>() ;
+        scratch.resize(data.size()) ;
+        auto amount = inflater_t::local().decompress(block.data.data(), block.data.size(), scratch.data(), scratch.size()) ;
+        return (amount == scratch.size()) && (scratch == data) ;
+    }
+public:
+    blockmaker_t(const uopoptions_t &options):options(options){}
+    auto make(std::uint32_t id, const std::vector<std::uint8_t> &data) ->uopblock_t {
+        if (!options.dedup){
+            return makeBlock(id, data, options.compression) ;
+        }
+        auto key = hashLittle2(std::string_view(reinterpret_cast<const char*>(data.data()),data.size())) ;
+        {
+            auto guard = std::lock_guard<std::mutex>(lock) ;
+            auto [first,last] = made.equal_range(key) ;
+            for ( ; first != last ; ++first){
+                if (matches(first->second, data)){
+                    auto rvalue = first->second ;
+                    rvalue.entry.identifier = hashName(hashformat,id) ;
+                    return rvalue ;
+                }
+            }
+        }
+        // Two threads could both make the same record here, which is only wasted work
+        auto rvalue = makeBlock(id, data, options.compression) ;
+        auto guard = std::lock_guard<std::mutex>(lock) ;
+        made.emplace(key,rvalue) ;
+        return rvalue ;
+    }
+    // The housing.bin block
+    auto house(const std::vector<std::uint8_t> &data) const ->uopblock_t {
+        return makeBlock(housingid, data, options.compression) ;
+    }
+};
+//=================================================================================
+// Writes count entries, followed by the housing.bin block, to a uop opened for count+1
+// entries. makeblock(index) is run on worker threads, but the blocks are written in
+// index order, so the file is the same no matter how many threads are used.  If given,
+// written(index,entry) is called with the table entry (offset set) as each block is
+// written, housing.bin is index count
+using writtenfunc_t = std::function<void(std::size_t,const table_entry&)> ;
+static auto writeUOP(uopwriter_t &output, std::size_t count, const std::function<uopblock_t(std::size_t)> &makeblock, const uopblock_t &house, std::size_t jobs, const writtenfunc_t &written = nullptr) ->void {
+    orderedParallel<uopblock_t>(count, jobs, makeblock, [&output,&written](std::size_t index, uopblock_t &&block){
+        block.entry.offset = output.add(block.entry, block.data.data(), block.data.size());
+        if (written){
+            written(index, block.entry) ;
+        }
+    });
+    // Now we need to housing.bin
+    auto entry = house.entry ;
+    entry.offset = output.add(house.entry, house.data.data(), house.data.size());
+    if (written){
+        written(count, entry) ;
+    }
+    output.close() ;
+}
+//=================================================================================
+// Csv parsing, all done in place on the text.  It accepts exactly what the strutil
+// based parsing (split, parse and ston) did.
+//=================================================================================
+constexpr auto csv_whitespace = std::string_view(" \t\v\f\n\r") ;
+//=================================================================================
+static auto trimView(std::string_view value) ->std::string_view {
+    auto start = value.find_first_not_of(csv_whitespace) ;
+    if (start == std::string_view::npos){
+        return std::string_view() ;
+    }
+    return value.substr(start, value.find_last_not_of(csv_whitespace) - start + 1) ;
+}
+//=================================================================================
+// Calls func with each (trimmed) field, until it returns false. As strutil::parse,
+// an empty field after a trailing separator is not a field.
+template <typename Func>
+static auto forEachField(std::string_view value, char sep, Func &&func) ->void {
+    auto current = std::size_t(0) ;
+    auto loc = value.find(sep,current) ;
+    while (loc != std::string_view::npos){
+        if (!func(trimView(value.substr(current, loc - current)))){
+            return ;
+        }
+        current = loc + 1 ;
+        loc = value.find(sep,current) ;
+    }
+    if (current < value.size()){
+        func(trimView(value.substr(current))) ;
+    }
+}
+//=================================================================================
+// strutil::ston: a radix indicator is any letter in the second character (and the
+// number may then be bad), otherwise it is decimal and must be a number
+template <typename T>
+static auto toNumber(std::string_view value) ->T {
+    auto rvalue = T{0} ;
+    if (value.empty()){
+        return rvalue ;
+    }
+    auto first = value.data() ;
+    auto last = value.data() + value.size() ;
+    if (value.size() < 2){
+        std::from_chars(first,last,rvalue,10) ;
+    }
+    else if (std::isalpha(static_cast<int>(value[1]))){
+        switch (value[1]) {
+            case 'b':
+            case 'B':
+                std::from_chars(first + 2,last,rvalue,2) ;
+                break;
+            case 'x':
+            case 'X':
+                std::from_chars(first + 2,last,rvalue,16) ;
+                break;
+            case 'o':
+            case 'O':
+                std::from_chars(first + 2,last,rvalue,8) ;
+                break;
+            default:
+                break;
+        }
+    }
+    else {
+        auto [ptr,ec] = std::from_chars(first,last,rvalue,10) ;
+        if (ec == std::errc::invalid_argument) {
+            throw std::runtime_error("Invalid argument for number conversion from string.");
+        }
+        else if (ec == std::errc::result_out_of_range) {
+            throw std::runtime_error("Out of range for number conversion from string.");
+        }
+    }
+    return rvalue ;
+}
+//=================================================================================
+// Csv writing, numbers are formatted straight into the output with to_chars, as
+// strutil::ntos would have
+//=================================================================================
+template <typename T>
+static auto appendNumber(std::string &output, T value) ->void {
+    auto digits = std::array<char,24>() ;
+    auto ptr = std::to_chars(digits.data(),digits.data() + digits.size(),value).ptr ;
+    output.append(digits.data(),ptr) ;
+}
+//=================================================================================
+// With the 0x prefix, zero padded to width digits
+template <typename T>
+static auto appendHex(std::string &output, T value, std::size_t width = 0) ->void {
+    auto digits = std::array<char,24>() ;
+    auto ptr = std::to_chars(digits.data(),digits.data() + digits.size(),value,16).ptr ;
+    auto count = static_cast<std::size_t>(ptr - digits.data()) ;
+    // ntos only had room for 12 digits, anything longer was written as nothing at all
+    if (count > static_cast<std::size_t>(strutil::max_characters_in_number)){
+        return ;
+    }
+    output += "0x" ;
+    if (count < width){
+        output.append(width - count,'0') ;
+    }
+    output.append(digits.data(),ptr) ;
+}
+//=================================================================================
+// A component line has something after the first comma, and is not the header
+static auto isComponentLine(std::string_view line) ->bool {
+    auto loc = line.find(',') ;
+    if ((loc == std::string_view::npos) || trimView(line.substr(loc + 1)).empty()){
+        return false ;
+    }
+    constexpr auto header = std::string_view("tileid") ;
+    auto first = trimView(line.substr(0,loc)) ;
+    if (first.size() != header.size()){
+        return true ;
+    }
+    for (std::size_t j = 0 ; j < header.size() ; j++){
+        if (std::tolower(static_cast<unsigned char>(first[j])) != header[j]){
+            return true ;
+        }
+    }
+    return false ;
+}
+//=================================================================================
+// The whole of a file, in text mode unless binary
+static auto readText(const std::filesystem::path &path, bool binary) ->std::string {
+    auto input = std::ifstream(path.string(), binary ? std::ios::in|std::ios::binary : std::ios::in);
+    if (!input.is_open()){
+        throw std::runtime_error("Unable to open: "s+path.string());
+    }
+    input.seekg(0,std::ios::end) ;
+    auto size = static_cast<std::size_t>(input.tellg()) ;
+    input.seekg(0,std::ios::beg) ;
+    auto text = std::string(size,0) ;
+    input.read(text.data(),text.size()) ;
+    // In text mode there can be fewer characters than bytes (line endings)
+    text.resize(static_cast<std::size_t>(input.gcount())) ;
+    return text ;
+}
+//=================================================================================
+// Adds the components in the text of a csv file to data
+static auto csvComponents(std::string_view text, std::vector<multi_component_t> &data) ->void {
+    // The lines are what getline into a 2048 buffer would give: a line longer than
+    // that is cut short and ends the file, and a nul ends the line
+    constexpr auto max_line = std::size_t(2047) ;
+    auto current = std::size_t(0) ;
+    while (current < text.size()){
+        auto end = text.find('\n',current) ;
+        auto length = ((end == std::string_view::npos) ? text.size() : end) - current ;
+        auto line = text.substr(current,std::min(length,max_line)) ;
+        line = line.substr(0,line.find('\0')) ;
+        if (isComponentLine(line)) {
+            // We are going to assume this is  a valid entry
+            data.push_back(multi_component_t(line));
+        }
+        if ((length > max_line) || (end == std::string_view::npos)){
+            break ;
+        }
+        current = end + 1 ;
+    }
+}
+//=================================================================================
+// Writes an idx/mul, with the entries for the ids (in increasing order) made by
+// makerecord(index) on worker threads, and written in id order.  Every id up to
+// maxid (at least minimum) gets an idx record, those not present are empty.  If given,
+// written(index,entry) is called with the offset and length of each record written
+static auto writeMUL(const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, const std::vector<std::uint32_t> &ids, const std::function<std::vector<std::uint8_t>(std::size_t)> &makerecord, std::size_t jobs, std::uint32_t minimum = idxmax, const writtenfunc_t &written = nullptr) ->void {
+    auto maxid = (ids.empty() ? 0 : ids.back()) + 1 ;
+    if (maxid < minimum) {
+        maxid = minimum ;
+    }
+    auto idx = std::ofstream(indexfile.string(),std::ios::binary);
+    if(!idx.is_open()){
+        throw std::runtime_error("Unable to create: "s+indexfile.string());
+    }
+    auto mul = std::ofstream(mulfile.string(),std::ios::binary);
+    if(!mul.is_open()){
+        throw std::runtime_error("Unable to create: "s+mulfile.string());
+    }
+    auto extra = std::uint32_t(0) ;
+    auto offset = std::uint32_t(0) ;
+    auto next = std::uint32_t(0) ;
+    auto skipto = [&idx,&next](std::uint32_t id){
+        auto length = std::uint32_t(0) ;
+        auto offset = std::uint32_t(0xFFFFFFFF) ;
+        for ( ; next < id ; next++){
+            idx.write(reinterpret_cast<char*>(&offset),4);
+            idx.write(reinterpret_cast<char*>(&length), 4);
+            idx.write(reinterpret_cast<char*>(&offset),4);
+        }
+    };
+    orderedParallel<std::vector<std::uint8_t>>(ids.size(), jobs, makerecord, [&](std::size_t index, std::vector<std::uint8_t> &&muldata){
+        auto id = ids[index] ;
+        skipto(id) ;
+        offset = static_cast<std::uint32_t>(mul.tellp()) ;
+        mul.write(reinterpret_cast<char*>(muldata.data()),muldata.size());
+        auto length = static_cast<std::uint32_t>(muldata.size());
+        idx.write(reinterpret_cast<char*>(&offset),4);
+        idx.write(reinterpret_cast<char*>(&length), 4);
+        idx.write(reinterpret_cast<char*>(&extra),4);
+        next = id + 1 ;
+        if (written){
+            auto entry = table_entry() ;
+            entry.offset = offset ;
+            entry.compressed_length = length ;
+            entry.decompressed_length = length ;
+            written(index, entry) ;
+        }
+    });
+    skipto(maxid) ;
+    // A failed write (a full disk say) has to be reported, not left as a short file
+    idx.flush() ;
+    mul.flush() ;
+    if (!idx.good()){
+        throw std::runtime_error("Unable to write: "s+indexfile.string());
+    }
+    if (!mul.good()){
+        throw std::runtime_error("Unable to write: "s+mulfile.string());
+    }
+    idx.close() ;
+    mul.close() ;
+    if (idx.fail() || mul.fail()){
+        throw std::runtime_error("Unable to write: "s+mulfile.string());
+    }
+}
+//=================================================================================
+// The compression policy as the settings of an incremental create (blocks made with a
+// different policy can not be reused)
+static auto policySettings(const compressionpolicy_t &policy) ->std::uint32_t {
+    auto values = std::array<std::int64_t,4>{policy.level, policy.strategy, static_cast<std::int64_t>(policy.rawbelow), policy.storeraw ? 1 : 0} ;
+    return hashAdler32(reinterpret_cast<const std::uint8_t*>(values.data()), sizeof(values)) ;
+}
+//=================================================================================
+// An incremental create from csv files: the manifest and mapping of the previous
+// output (if it has a valid manifest), and the records for the new manifest by index
+//=================================================================================
+struct incremental_t {
+    manifest_t previous ;
+    mappedfile_t output ;
+    std::vector<std::pair<std::uint32_t,manifestrecord_t>> records ;
+    std::uint32_t settings ;
+    // settings is what (other than the csv files) the blocks depend on
+    incremental_t(const std::filesystem::path &path, std::size_t count, std::uint32_t settings = 0):previous(settings),records(count),settings(settings) {
+        if (previous.load(path) && !output.open(path)){
+            previous.clear() ;
+        }
+    }
+    // The block for the source of id.  If it has the same size and time (or contents)
+    // as the previous create, the block is copied from the previous output, otherwise
+    // make(contents) makes it.  Each index must only be used by one thread
+    auto block(std::size_t index, std::uint32_t id, const std::filesystem::path &source, bool binary, const std::function<uopblock_t(const std::string&)> &make) ->uopblock_t {
+        auto &record = records[index] ;
+        record.first = id ;
+        record.second = manifestrecord_t::stamp(source) ;
+        auto prior = previous.find(id) ;
+        auto samesize = (prior != nullptr) && (prior->size == record.second.size) ;
+        if (samesize && (prior->time == record.second.time)){
+            record.second.hash = prior->hash ;
+            return copy(*prior) ;
+        }
+        auto text = readText(source, binary) ;
+        record.second.hash = hashLittle2(text) ;
+        if (samesize && (prior->hash == record.second.hash)){
+            return copy(*prior) ;
+        }
+        return make(text) ;
+    }
+    auto copy(const manifestrecord_t &prior) const ->uopblock_t {
+        auto rvalue = uopblock_t() ;
+        rvalue.entry = prior.entry ;
+        auto bytes = output.view(prior.entry.offset + prior.entry.header_length, prior.entry.compressed_length) ;
+        rvalue.data.assign(bytes.begin(),bytes.end()) ;
+        return rvalue ;
+    }
+    // Once the new output has replaced the old, write its manifest
+    auto save(const std::filesystem::path &path) const ->void {
+        auto manifest = manifest_t(settings) ;
+        for (const auto &[id,record] : records){
+            manifest.insert(id, record) ;
+        }
+        manifest.save(path) ;
+    }
+};
+//=================================================================================
+// Moves the temporary outputs over the real ones, or removes them if the create failed
+static auto replaceOutputs(const std::vector<std::filesystem::path> &outputs, bool succeeded) ->void {
+    for (const auto &path : outputs){
+        auto temporary = manifest_t::temporaryPath(path) ;
+        if (succeeded){
+            std::filesystem::rename(temporary, path) ;
+        }
+        else {
+            auto error = std::error_code() ;
+            std::filesystem::remove(temporary, error) ;
+        }
+    }
+}
 //=================================================================================
 auto multi_component_t::operator<(const multi_component_t &value) const ->bool {
     auto rvalue = true ;
@@ -37,50 +504,66 @@ auto multi_component_t::operator<(const multi_component_t &value) const ->bool {
 }
 //=================================================================================
 auto multi_component_t::description() const ->std::string {
-    std::stringstream output ;
-    output << strutil::ntos<std::uint16_t>(tileid,strutil::radix_t::hex,true,4)<<",";
-    output<<strutil::ntos<std::int16_t>(offsetx)<<",";
-    output<<strutil::ntos<std::int16_t>(offsety)<<",";
-    output<<strutil::ntos<std::int16_t>(offsetz)<<",";
-    output<<strutil::ntos<std::uint64_t>(flag,strutil::radix_t::hex,true) <<",";
+    auto rvalue = std::string() ;
+    description(rvalue) ;
+    return rvalue ;
+}
+//=================================================================================
+auto multi_component_t::description(std::string &output) const ->void {
+    appendHex(output,tileid,4) ;
+    output += ',' ;
+    appendNumber(output,offsetx) ;
+    output += ',' ;
+    appendNumber(output,offsety) ;
+    output += ',' ;
+    appendNumber(output,offsetz) ;
+    output += ',' ;
+    appendHex(output,flag) ;
+    output += ',' ;
     for (const auto &value:cliloc) {
-        output<<strutil::ntos<std::uint32_t>(value)<<":";
+        appendNumber(output,value) ;
+        output += ':' ;
     }
-    return output.str() ;
 }
 //===========================================================================
-multi_component_t::multi_component_t(const std::string &entry) :multi_component_t() {
-    auto comp = strutil::parse(entry,",") ;
-    switch (comp.size()){
+multi_component_t::multi_component_t(std::string_view entry) :multi_component_t() {
+    // The fields (trimmed), only the first 6 matter
+    auto comp = std::array<std::string_view,6>() ;
+    auto count = std::size_t(0) ;
+    forEachField(entry, ',', [&comp,&count](std::string_view value){
+        comp[count++] = value ;
+        return count < comp.size() ;
+    });
+    switch (count){
         default:
         case 6: {
-            auto values = strutil::parse(comp.at(5),":") ;
-            for (const auto &value:values){
+            forEachField(comp[5], ':', [this](std::string_view value){
                 if (!value.empty()) {
-                    cliloc.push_back(strutil::ston<std::uint32_t>(value));
+                    cliloc.push_back(toNumber<std::uint32_t>(value));
                 }
-            }
+                return true ;
+            });
             [[fallthrough]];
         }
         case 5: {
-            flag = strutil::ston<std::uint64_t>(comp.at(4));
+            flag = toNumber<std::uint64_t>(comp[4]);
             [[fallthrough]];
         }
         case 4: {
-            offsetz = strutil::ston<std::int16_t>(comp.at(3));
+            offsetz = toNumber<std::int16_t>(comp[3]);
             [[fallthrough]];
         }
 
         case 3: {
-            offsety = strutil::ston<std::int16_t>(comp.at(2));
+            offsety = toNumber<std::int16_t>(comp[2]);
             [[fallthrough]];
         }
         case 2: {
-            offsetx = strutil::ston<std::int16_t>(comp.at(1));
+            offsetx = toNumber<std::int16_t>(comp[1]);
             [[fallthrough]];
         }
         case 1: {
-            tileid = strutil::ston<std::uint16_t>(comp.at(0));
+            tileid = toNumber<std::uint16_t>(comp[0]);
             [[fallthrough]];
         }
         case 0:{
@@ -114,20 +597,7 @@ auto multi_component_t::loaduop(const std::uint8_t *data) ->int {
     auto lflag = std::uint16_t(0) ;
     offset+=2 ;
     std::copy(data+offset,data+offset+2,reinterpret_cast<std::uint8_t*>(&lflag));
-    switch (lflag) {
-        default:
-        case 0:
-            flag =1 ;
-            break;
-        case 256:
-            flag =0x0000000100000001;
-            break;
-        case 257:
-            flag = 0x0000000100000000;
-            break;
-        case 1:
-            flag = 0 ;
-    }
+    flag = uopFlag(lflag) ;
     auto count = std::uint32_t(0);
     offset+=2 ;
     std::copy(data+offset,data+offset+4,reinterpret_cast<std::uint8_t*>(&count));
@@ -208,67 +678,159 @@ auto multi_component_t::data(bool isuop ) const ->std::vector<std::uint8_t> {
 }
 
 //===========================================================================
-// multi_t
+// component_view_t
 //===========================================================================
 //===========================================================================
-multi_t::multi_t(const std::vector<std::uint8_t> &bytes, bool isuop) :multi_t() {
-    auto numentries = bytes.size() / multi_component_t::mul_record_size ; // Lets just assume mul for a minute
-    auto dataoffset = 0 ;
+auto component_view_t::flag() const ->std::uint64_t {
     if (isuop){
-        dataoffset = 4 ;
-        std::copy(bytes.data()+dataoffset,bytes.data()+dataoffset+4,reinterpret_cast<std::uint8_t*>(&numentries));
-        dataoffset += 4 ;
+        return uopFlag(value<std::uint16_t>(8)) ;
     }
-    for (auto j=0 ; j < numentries;j++){
-        
-        auto component = multi_component_t() ;
-        if(isuop){
-            dataoffset += component.loaduop(bytes.data()+dataoffset);
-        }
-        else {
-            dataoffset += component.loadmul(bytes.data()+dataoffset);
+    return value<std::uint64_t>(8) ;
+}
+//===========================================================================
+auto component_view_t::size() const ->std::size_t {
+    if (isuop){
+        return 14 + static_cast<std::size_t>(clilocCount()) * 4 ;
+    }
+    return multi_component_t::mul_record_size ;
+}
+//===========================================================================
+auto component_view_t::component() const ->multi_component_t {
+    auto rvalue = multi_component_t() ;
+    if (isuop){
+        rvalue.loaduop(ptr) ;
+    }
+    else {
+        rvalue.loadmul(ptr) ;
+    }
+    return rvalue ;
+}
+//===========================================================================
+// multi_view_t
+//===========================================================================
+//===========================================================================
+auto multi_view_t::iterator::operator++() ->iterator& {
+    ptr += component_view_t(ptr,isuop).size() ;
+    index++ ;
+    return *this ;
+}
+//===========================================================================
+multi_view_t::multi_view_t(const std::uint8_t *bytes, std::size_t size, bool isuop):ptr(bytes),count(size / multi_component_t::mul_record_size),isuop(isuop) {
+    if (isuop){
+        // The uop record has a 4 byte (unknown) value, then the component count
+        auto numentries = std::uint32_t(0) ;
+        if (size >= 8){
+            std::copy(bytes+4,bytes+8,reinterpret_cast<std::uint8_t*>(&numentries));
         }
-        data.push_back(component);
+        // The count comes from the data, but no more components than the smallest
+        // (14 bytes, no clilocs) can fit in it
+        constexpr auto smallest = std::size_t(14) ;
+        count = std::min(static_cast<std::size_t>(numentries), (size >= 8) ? (size - 8) / smallest : std::size_t(0)) ;
+        ptr = bytes + 8 ;
+    }
+}
+//===========================================================================
+auto multi_view_t::begin() const ->iterator {
+    return iterator(ptr,0,isuop) ;
+}
+//===========================================================================
+auto multi_view_t::record(bool touop) const ->std::vector<std::uint8_t> {
+    auto rvalue = std::vector<std::uint8_t>() ;
+    rvalue.reserve(count * multi_component_t::mul_record_size + 8) ;
+    if (touop) {
+        // we need a header, and number of entries
+        auto header = std::uint32_t(0) ;
+        rvalue.resize(8,0) ;
+        header = static_cast<std::uint32_t>(count) ;
+        std::copy(reinterpret_cast<std::uint8_t*>(&header),reinterpret_cast<std::uint8_t*>(&header)+4,rvalue.begin()+4);
+    }
+    for (const auto &component : *this){
+        auto temp = component.component().data(touop) ;
+        rvalue.insert(rvalue.end(),temp.begin(),temp.end()) ;
+    }
+    return rvalue ;
+}
+//===========================================================================
+// multicache_t
+//===========================================================================
+//===========================================================================
+multicache_t::multicache_t(std::size_t budget):budget(budget),used(0),hits(0),misses(0) {
+}
+//===========================================================================
+auto multicache_t::find(std::uint32_t id) ->data_t {
+    auto guard = std::lock_guard<std::mutex>(lock) ;
+    auto iter = lookup.find(id) ;
+    if (iter == lookup.end()){
+        misses++ ;
+        return nullptr ;
     }
+    hits++ ;
+    // Move it to the front, it is now the most recent
+    items.splice(items.begin(),items,iter->second) ;
+    return iter->second->data ;
+}
+//===========================================================================
+auto multicache_t::insert(std::uint32_t id, data_t data) ->void {
+    if ((data == nullptr) || (data->size() > budget)){
+        return ;
+    }
+    auto guard = std::lock_guard<std::mutex>(lock) ;
+    auto iter = lookup.find(id) ;
+    if (iter != lookup.end()){
+        // Another thread beat us to it
+        items.splice(items.begin(),items,iter->second) ;
+        return ;
+    }
+    used += data->size() ;
+    items.push_front(item_t{id,std::move(data)}) ;
+    lookup.insert_or_assign(id,items.begin()) ;
+    while (used > budget){
+        used -= items.back().data->size() ;
+        lookup.erase(items.back().id) ;
+        items.pop_back() ;
+    }
+}
+//===========================================================================
+auto multicache_t::clear() ->void {
+    auto guard = std::lock_guard<std::mutex>(lock) ;
+    items.clear() ;
+    lookup.clear() ;
+    used = 0 ;
+}
+//===========================================================================
+auto multicache_t::statistics() const ->cachestats_t {
+    auto guard = std::lock_guard<std::mutex>(lock) ;
+    return cachestats_t{hits.load(),misses.load(),items.size(),used,budget} ;
+}
+//===========================================================================
+// multi_t
+//===========================================================================
+//===========================================================================
+multi_t::multi_t(const multi_view_t &view) :multi_t() {
+    data.reserve(view.size()) ;
+    for (const auto &component : view){
+        data.push_back(component.component()) ;
+    }
+}
+//===========================================================================
+multi_t::multi_t(const std::vector<std::uint8_t> &bytes, bool isuop) :multi_t(bytes.data(),bytes.size(),isuop) {
+}
+//===========================================================================
+multi_t::multi_t(const std::uint8_t *bytes, std::size_t size, bool isuop) :multi_t(multi_view_t(bytes,size,isuop)) {
 }
 //===========================================================================
 multi_t::multi_t(std::vector<std::string> text) :multi_t() {
     for (auto const &line : text){
-        if (!line.empty()){
-            auto [first,rest] = strutil::split(line,",");
-            
-            if ((strutil::lower(first) != "tileid") && (!rest.empty())) {
-                // We are going to assume this is  a valid entry
-                data.push_back(multi_component_t(line));
-            }
+        if (isComponentLine(line)) {
+            // We are going to assume this is  a valid entry
+            data.push_back(multi_component_t(line));
         }
     }
 }
 //===========================================================================
+// The whole file is read at once, and the lines parsed in place
 multi_t::multi_t(const std::filesystem::path &csvfile):multi_t(){
-    auto input = std::ifstream(csvfile.string());
-    if (!input.is_open()){
-        throw std::runtime_error("Unable to open: "s+csvfile.string());
-    }
-    auto data = std::vector<char>(2049,0) ;
-    while(input.good() && !input.eof()){
-        input.getline(data.data(), 2048) ;
-        std::string text = data.data() ;
-        if (!text.empty()){
-            if (text[text.size()-1] == '\n') {
-                text.resize(text.size()-1, 0);
-            }
-            if (!text.empty()){
-                auto [first,rest] = strutil::split(text,",");
-                
-                if ((strutil::lower(first) != "tileid") && (!rest.empty())) {
-                    // We are going to assume this is  a valid entry
-                    this->data.push_back(multi_component_t(text));
-                }
-
-            }
-        }
-    }
+    csvComponents(readText(csvfile,false), data) ;
 }
 
 //===========================================================================
@@ -286,10 +848,21 @@ auto multi_t::operator()(std::int32_t index) ->multi_component_t& {
 }
 //===========================================================================
 auto multi_t::description(std::ostream &output) const ->void {
-    output <<"TileID,OffsetX,OffsetY,OffsetZ,Flag,Cliloc\n";
+    // Formatted into a buffer (kept for the next call), written out a block at a time
+    constexpr auto block_size = std::size_t(64 * 1024) ;
+    thread_local auto buffer = std::string() ;
+    buffer.clear() ;
+    buffer.reserve(block_size + 1024) ;
+    buffer += "TileID,OffsetX,OffsetY,OffsetZ,Flag,Cliloc\n" ;
     for (const auto &rec:data){
-        output << rec.description()<<"\n";
+        rec.description(buffer) ;
+        buffer += '\n' ;
+        if (buffer.size() >= block_size){
+            output.write(buffer.data(),buffer.size()) ;
+            buffer.clear() ;
+        }
     }
+    output.write(buffer.data(),buffer.size()) ;
 }
 //===========================================================================
 auto multi_t::record(bool isuop) const ->std::vector<std::uint8_t> {
@@ -310,91 +883,139 @@ auto multi_t::record(bool isuop) const ->std::vector<std::uint8_t> {
 }
 
 
+//===========================================================================
+// entrytable_t
+//===========================================================================
+//===========================================================================
+auto entrytable_t::insert(std::uint32_t id, const table_entry &entry) ->void {
+    if (id >= slots.size()){
+        slots.resize(static_cast<std::size_t>(id) + 1, absent) ;
+    }
+    if (slots[id] != absent){
+        entries[slots[id]] = entrylocation_t(entry) ;
+    }
+    else {
+        slots[id] = static_cast<std::uint32_t>(entries.size()) ;
+        entries.emplace_back(entry) ;
+    }
+}
 //===========================================================================
 // multistorage_t
 //===========================================================================
 
 //===========================================================================
-auto multistorage_t::retrieve_idxaccess(std::ifstream &idxfile) ->void {
+auto multistorage_t::retrieve_idxaccess(const mappedfile_t &idxfile) ->void {
     entry_location.clear() ;
-    housing_location = table_entry() ;
-    auto id = 0 ;
-    while (idxfile.good() && !idxfile.eof()){
+    housing_location = entrylocation_t() ;
+    constexpr auto idxrecordsize = 12 ;
+    auto numrecords = idxfile.size() / idxrecordsize ;
+    auto ptr = idxfile.data() ;
+    for (std::uint32_t id = 0 ; id < numrecords ; id++){
         auto entry = table_entry() ;
-        idxfile.read(reinterpret_cast<char*>(&entry.offset),4);
-        idxfile.read(reinterpret_cast<char*>(&entry.compressed_length),4);
-        idxfile.read(reinterpret_cast<char*>(&entry.decompressed_length),4);
+        std::copy(ptr,ptr+4,reinterpret_cast<std::uint8_t*>(&entry.offset));
+        std::copy(ptr+4,ptr+8,reinterpret_cast<std::uint8_t*>(&entry.compressed_length));
         entry.decompressed_length = entry.compressed_length ;
-        if (idxfile.gcount() ==4){
-            if ((entry.offset < 0xFFFFFFFE)  && (entry.compressed_length>0) ){
-                // This is a valid entry ;
-                entry_location.insert_or_assign(id,entry) ;
-            }
+        if ((entry.offset < 0xFFFFFFFE)  && (entry.compressed_length>0) ){
+            // This is a valid entry ;
+            entry_location.insert(id,entry) ;
         }
-        id++ ;
+        ptr += idxrecordsize ;
     }
 }
 //===========================================================================
 auto multistorage_t::retrieve_uopaccess(std::ifstream &uopfile) ->void {
     entry_location.clear() ;
-    housing_location = table_entry() ;
-    // Gather all the hashes
-    auto offsets = gatherEntryOffsets(uopfile) ;
-    // Create our hashset
-    auto hashstring = "build/multicollection/%.6u.bin"s ;
-    auto hashes = hashset_t(hashstring,0,0x10000) ; ;
-    // Now add the hashstring for housing.bin
-    hashes.insert(housinghash,0xFFFFFFFE) ;
-    entry_location = createIDTableMapping(uopfile,hashes,offsets) ;
-    // Now, the only issue, if this "should" enclude the housing.bin, so lets get that
-    auto iter = entry_location.find(0xFFFFFFFE) ;
-    if (iter == entry_location.end()){
+    housing_location = entrylocation_t() ;
+    // The same as createIDTableMapping, but housing.bin is kept apart (its id is
+    // nowhere near the others)
+    const auto &hashes = multiHashes() ;
+    auto entries = gatherTableEntries(uopfile) ;
+    entry_location.reserve(entries.size()) ;
+    auto foundhousing = false ;
+    for (const auto &entry : entries){
+        if (entry.valid()){
+            auto id = hashes.find(entry.identifier) ;
+            if (id != nullptr){
+                if (*id == housingid){
+                    housing_location = entrylocation_t(entry) ;
+                    foundhousing = true ;
+                }
+                else {
+                    entry_location.insert(*id,entry) ;
+                }
+            }
+        }
+    }
+    // Now, the only issue, if this "should" enclude the housing.bin
+    if (!foundhousing){
         // No housing bin located
         throw std::runtime_error("housing.bin hash not found");
     }
-    housing_location = iter->second ;
-    entry_location.erase(iter) ;
 }
 
 //==========================================================================
-auto multistorage_t::gatherTextMulti(const std::filesystem::path &path)  -> std::map<std::uint32_t,std::filesystem::path> {
+// If the path is a csv file named for an id, add it to entries
+static auto addTextMulti(const std::filesystem::path &path, std::vector<std::pair<std::uint32_t,std::filesystem::path>> &entries) ->void {
+    if (strutil::lower(path.extension().string())==".csv"){
+        // This could be one
+        auto name =path.stem().string() ;
+        auto loc = name.find_first_not_of("0") ;
+        if (loc != std::string::npos){
+            name = name.substr(loc) ;
+        }
+        else {
+            name = "0";
+        }
+        try {
+            auto id = static_cast<std::uint32_t>(std::stoul(name,nullptr,0)) ;
+            entries.push_back(std::make_pair(id, path)) ;
+        }
+        catch(...) {
+            std::cerr <<"Skipping non-id csv file: "<<path.string()<<std::endl;
+        }
+    }
+}
+//==========================================================================
+// Each top level entry (and everything under it, if a directory) is searched on a
+// worker, and the results are combined in the order a single recursive walk would
+// have found them (so if an id is in more than one file, the same one wins)
+auto multistorage_t::gatherTextMulti(const std::filesystem::path &path, std::size_t jobs)  -> std::map<std::uint32_t,std::filesystem::path> {
     auto rvalue = std::map<std::uint32_t,std::filesystem::path>() ;
-    for (auto const &dir_entry : std::filesystem::recursive_directory_iterator(path)){
-        if (strutil::lower(dir_entry.path().extension().string())==".csv"){
-            // This could be one
-            auto name =dir_entry.path().stem().string() ;
-            auto loc = name.find_first_not_of("0") ;
-            if (loc != std::string::npos){
-                name = name.substr(loc) ;
-            }
-            else {
-                name = "0";
+    auto toplevel = std::vector<std::filesystem::directory_entry>(std::filesystem::directory_iterator(path),std::filesystem::directory_iterator()) ;
+    using found_t = std::vector<std::pair<std::uint32_t,std::filesystem::path>> ;
+    orderedParallel<found_t>(toplevel.size(), jobs, [&toplevel](std::size_t index){
+        auto found = found_t() ;
+        const auto &entry = toplevel[index] ;
+        addTextMulti(entry.path(), found) ;
+        // recursive_directory_iterator does not follow directory symlinks, nor do we
+        if (entry.is_directory() && !entry.is_symlink()){
+            for (auto const &dir_entry : std::filesystem::recursive_directory_iterator(entry.path())){
+                addTextMulti(dir_entry.path(), found) ;
             }
-            try {
-                auto id = static_cast<std::uint32_t>(std::stoul(name,nullptr,0)) ;
-                rvalue.insert_or_assign(id, dir_entry.path()) ;
-            }
-            catch(...) {
-                std::cerr <<"Skipping non-id csv file: "<<dir_entry.path().string()<<std::endl;
-            }
-         }
-    }
+        }
+        return found ;
+    }, [&rvalue](std::size_t, found_t &&found){
+        for (auto &[id,csvpath] : found){
+            rvalue.insert_or_assign(id, std::move(csvpath)) ;
+        }
+    });
     return rvalue ;
 }
 
 
 //====================================================================================
 multistorage_t::multistorage_t(const std::filesystem::path &datafile, const std::filesystem::path &indexfile){
-    this->datafile = std::ifstream(datafile.string(),std::ios::binary) ;
-    if (!this->datafile.is_open()){
+    if (!this->datafile.open(datafile)){
         throw std::runtime_error("Failed to open: "s + datafile.string());
     }
     
     if (indexfile.empty()){
-        // we think this is a uop, lets check
-        if (validUOP(this->datafile)) {
+        // we think this is a uop, lets check. The tables are only read once, so
+        // a stream is fine for that
+        auto input = std::ifstream(datafile.string(),std::ios::binary) ;
+        if (validUOP(input)) {
             isuop = true ;
-            retrieve_uopaccess(this->datafile);
+            retrieve_uopaccess(input);
         }
         else {
             throw std::runtime_error("Invalid uop: "s + datafile.string());
@@ -403,7 +1024,7 @@ multistorage_t::multistorage_t(const std::filesystem::path &datafile, const std:
     else {
         // Ok, so we are thinking idx/mul
         this->indexfile = indexfile ;
-        auto input = std::ifstream(indexfile.string(),std::ios::binary) ;
+        auto input = mappedfile_t(indexfile) ;
         if (!input.is_open()){
             throw std::runtime_error("Failed to open: "s +  indexfile.string());
         }
@@ -412,11 +1033,40 @@ multistorage_t::multistorage_t(const std::filesystem::path &datafile, const std:
     }
 }
 
+//====================================================================================
+auto multistorage_t::hashCache(const std::filesystem::path &cachepath) ->void {
+    multiHashCache() = cachepath ;
+}
 //====================================================================================
 auto multistorage_t::maxid() const ->std::uint32_t {
-    auto iter = entry_location.rbegin() ;
-    return iter->first ;
-
+    return entry_location.maxid() ;
+}
+//====================================================================================
+auto multistorage_t::ids(bool fileorder) const ->std::vector<std::uint32_t> {
+    auto rvalue = std::vector<std::uint32_t>(entry_location.begin(),entry_location.end()) ;
+    if (fileorder){
+        std::stable_sort(rvalue.begin(),rvalue.end(),[this](std::uint32_t lhs, std::uint32_t rhs){
+            return entry_location.find(lhs)->offset < entry_location.find(rhs)->offset ;
+        });
+    }
+    return rvalue ;
+}
+//====================================================================================
+auto multistorage_t::nonempty() const ->std::vector<std::uint32_t> {
+    auto rvalue = std::vector<std::uint32_t>() ;
+    rvalue.reserve(entry_location.size()) ;
+    for (auto id : entry_location){
+        if (entry_location.find(id)->decompressed_length >= multi_component_t::mul_record_size){
+            rvalue.push_back(id) ;
+        }
+    }
+    return rvalue ;
+}
+//====================================================================================
+auto multistorage_t::record(std::uint32_t id, bool touop) const ->std::vector<std::uint8_t> {
+    // Each thread decompresses into its own buffer
+    thread_local auto scratch = std::vector<std::uint8_t>() ;
+    return view(id,scratch).record(touop) ;
 }
 //====================================================================================
 auto multistorage_t::saveHousing(const std::filesystem::path &filepath) const ->void {
@@ -427,304 +1077,310 @@ auto multistorage_t::saveHousing(const std::filesystem::path &filepath) const ->
     if (!output.is_open()){
         throw std::runtime_error("Unable to create: "s + filepath.string());
     }
-    auto offset = housing_location.offset + housing_location.header_length ;
-    auto data = std::vector<std::uint8_t>(housing_location.compressed_length,0) ;
-    datafile.seekg(offset,std::ios::beg);
-    datafile.read(reinterpret_cast<char*>(data.data()),data.size()) ;
-    if (housing_location.compression){
-        // uncompress the data!
-        auto temp = std::vector<std::uint8_t>(housing_location.decompressed_length,0) ;
-        
-        auto destsize = static_cast<uLong>(temp.size())  ;
-        auto srcsize = static_cast<uLong>(data.size()) ;
-        auto status = uncompress2(temp.data(), &destsize, data.data(), &srcsize);
-        if (status != Z_OK){
-            throw std::runtime_error("Decompression error");
-        }
-        std::swap(data,temp) ;
-    }
+    auto data = housing() ;
     output.write(reinterpret_cast<char*>(data.data()), data.size());
 }
 
 //====================================================================================
 auto multistorage_t::operator[](std::uint32_t index) const -> multi_t {
-    auto rvalue = multi_t() ;
-    auto iter = entry_location.find(index) ;
-    if (iter != entry_location.end()){
-        
-        constexpr auto componentmulsize = 16 ;
-        if (iter->second.decompressed_length >= componentmulsize) {
-            auto offset = iter->second.offset + iter->second.header_length ;
-            auto data = std::vector<std::uint8_t>(iter->second.compressed_length,0) ;
-            datafile.seekg(offset,std::ios::beg);
-            
-            datafile.read(reinterpret_cast<char*>(data.data()),data.size()) ;
-            if (iter->second.compression){
-                // uncompress the data!
-                auto temp = std::vector<std::uint8_t>(iter->second.decompressed_length,0) ;
-                
-                auto destsize = static_cast<uLong>(temp.size())  ;
-                auto srcsize = static_cast<uLong>(data.size()) ;
-                auto status = uncompress2(temp.data(), &destsize, data.data(), &srcsize);
-                if (status != Z_OK){
-                    throw std::runtime_error("Decompression error");
-                }
-                std::swap(data,temp) ;
-            }
-            rvalue = multi_t(data,isuop) ;
+    if (!cache){
+        auto scratch = std::vector<std::uint8_t>() ;
+        return multi_t(view(index,scratch)) ;
+    }
+    auto data = cache->find(index) ;
+    if (data == nullptr){
+        auto entry = entry_location.find(index) ;
+        if ((entry == nullptr) || (entry->decompressed_length < multi_component_t::mul_record_size)){
+            return multi_t() ;
         }
+        auto bytes = datafile.view(entry->offset + entry->header_length, entry->compressed_length) ;
+        data = std::make_shared<const std::vector<std::uint8_t>>(entryData(*entry, bytes)) ;
+        cache->insert(index, data) ;
     }
-    return rvalue;
+    return multi_t(data->data(),data->size(),isuop) ;
+}
+//====================================================================================
+auto multistorage_t::extract(const std::function<void(std::uint32_t,const multi_view_t&)> &sink, std::size_t jobs) const ->void {
+    auto order = ids(true) ;
+    // Each worker decompresses into its own buffer
+    auto scratch = std::vector<std::vector<std::uint8_t>>(jobCount(jobs)) ;
+    // Read ahead of where we are a chunk at a time
+    auto prefetched = std::atomic<std::uint64_t>(0) ;
+    datafile.advise(mappedfile_t::access_t::sequential) ;
+    parallelFor(order.size(), jobs, [this,&order,&scratch,&prefetched,&sink](std::size_t index, std::size_t worker){
+        auto id = order[index] ;
+        auto entry = entry_location.find(id) ;
+        auto end = entry->offset + entry->header_length + entry->compressed_length ;
+        auto current = prefetched.load() ;
+        if ((end > current) && prefetched.compare_exchange_strong(current, entry->offset + bulk_chunk)){
+            datafile.prefetch(entry->offset, bulk_chunk) ;
+        }
+        sink(id, view(id,scratch[worker])) ;
+    });
+    datafile.advise(mappedfile_t::access_t::normal) ;
+}
+//====================================================================================
+auto multistorage_t::enableCache(std::size_t budget) ->void {
+    if (budget == 0){
+        cache.reset() ;
+    }
+    else {
+        cache = std::make_unique<multicache_t>(budget) ;
+    }
+}
+//====================================================================================
+auto multistorage_t::cacheStatistics() const ->cachestats_t {
+    if (!cache){
+        return cachestats_t{0,0,0,0,0} ;
+    }
+    return cache->statistics() ;
+}
+//====================================================================================
+auto multistorage_t::view(std::uint32_t index, std::vector<std::uint8_t> &scratch) const ->multi_view_t {
+    auto entry = entry_location.find(index) ;
+    if ((entry == nullptr) || (entry->decompressed_length < multi_component_t::mul_record_size)){
+        return multi_view_t() ;
+    }
+    auto bytes = datafile.view(entry->offset + entry->header_length, entry->compressed_length) ;
+    if (!entry->compression){
+        return multi_view_t(bytes.data,bytes.size,isuop) ;
+    }
+    entryData(*entry, bytes, scratch) ;
+    return multi_view_t(scratch.data(),scratch.size(),isuop) ;
+}
+//====================================================================================
+auto multistorage_t::entry(std::uint32_t index) const ->byteview_t {
+    auto entry = entry_location.find(index) ;
+    if (entry == nullptr){
+        return byteview_t() ;
+    }
+    return datafile.view(entry->offset + entry->header_length, entry->compressed_length) ;
 }
 
 //====================================================================================
-auto multistorage_t::saveUOP(const std::filesystem::path &csvdirectory ,const std::filesystem::path &uopfile, const std::filesystem::path &housingpath)->void {
-    auto entries = gatherTextMulti(csvdirectory) ;
+auto multistorage_t::saveUOP(const std::filesystem::path &csvdirectory ,const std::filesystem::path &uopfile, const std::filesystem::path &housingpath, std::size_t jobs, bool incremental, const uopoptions_t &options)->void {
+    auto entries = gatherTextMulti(csvdirectory,jobs) ;
     
     if (entries.empty()){
         throw std::runtime_error("No valid csv entries found at: "s + csvdirectory.string());
     }
+    auto ids = std::vector<std::pair<std::uint32_t,std::filesystem::path>>(entries.begin(),entries.end()) ;
+    auto maker = blockmaker_t(options) ;
+    if (incremental){
+        // The manifest is kept with the uop, the blocks are copied from it
+        auto state = incremental_t(uopfile, ids.size() + 1, policySettings(options.compression)) ;
+        try {
+            auto output = uopwriter_t(manifest_t::temporaryPath(uopfile), static_cast<std::uint32_t>(ids.size()) + 1, options.dedup) ;
+            if (!output.is_open()){
+                throw std::runtime_error("Unable to create: "s + uopfile.string()) ;
+            }
+            auto house = state.block(ids.size(), housingid, csvdirectory / housingpath, true, [&maker](const std::string &data){
+                return maker.house(std::vector<std::uint8_t>(data.begin(),data.end())) ;
+            });
+            // The workers parse, serialize and compress each csv that changed, and copy
+            // the blocks of those that did not
+            writeUOP(output, ids.size(), [&ids,&state,&maker](std::size_t index){
+                return state.block(index, ids[index].first, ids[index].second, false, [&ids,&maker,index](const std::string &text){
+                    auto multi = multi_t() ;
+                    csvComponents(text, multi.data) ;
+                    return maker.make(ids[index].first, multi.record(true)) ;
+                });
+            }, house, jobs, [&state](std::size_t index, const table_entry &entry){
+                state.records[index].second.entry = entry ;
+            }) ;
+        }
+        catch(...){
+            replaceOutputs({uopfile}, false) ;
+            throw ;
+        }
+        // Only a completely written output gets here.  The old one has to be let go of
+        // before it is replaced
+        state.output.close() ;
+        replaceOutputs({uopfile}, true) ;
+        state.save(uopfile) ;
+        return ;
+    }
     auto housing = std::ifstream((csvdirectory / housingpath).string(),std::ios::binary) ;
     if (!housing.is_open()){
         throw std::runtime_error("Unable to open: "s + (csvdirectory / housingpath).string());
     }
-    auto output = std::ofstream(uopfile.string(),std::ios::binary) ;
+    auto output = uopwriter_t(uopfile, static_cast<std::uint32_t>(entries.size()) + 1, options.dedup) ;
     if (!output.is_open()){
         throw std::runtime_error("Unable to create: "s + uopfile.string()) ;
     }
-    auto offsets = createUOP(output, static_cast<std::uint32_t>(entries.size())+1) ;
-    auto offset = output.tellp() ;
-    auto count = 0 ;
-    for (auto const &[id,path]:entries){
-        auto collection = multi_t(path) ;
-        auto data = collection.record(true) ;
-        auto table = table_entry() ;
-        table.decompressed_length = static_cast<std::uint32_t>(data.size()) ;
-        table.compression = 1 ;
-        auto destsize = static_cast<uLong>(compressBound(static_cast<uLong>(data.size())));
-        auto dest = std::vector<std::uint8_t>(destsize,0) ;
-        auto srcsize = uLongf(data.size());
-        
-        auto status = compress(dest.data(), &destsize, data.data(), srcsize) ;
-        if (status != Z_OK) {
-            throw std::runtime_error("Error compressing data for entry: "s + std::to_string(id));
-        }
-        dest.resize(destsize);
-        std::swap(dest,data) ;
-        table.compressed_length = static_cast<std::uint32_t>(data.size());
-        table.identifier = hashLittle2(strutil::format(hashformat,id));
-        table.data_block_hash = hashAdler32(data);
-        table.offset = output.tellp() ;
-        output.seekp(offset,std::ios::beg);
-        output.write(reinterpret_cast<char*>(data.data()),data.size());
-        offset = output.tellp();
-        output.seekp(offsets[count],std::ios::beg);
-        table.save(output);
-        output.seekp(offset,std::ios::beg) ;
-        count++ ;
-    }
-    // Now we need to housing.bin
     housing.seekg(0,std::ios::end) ;
     auto size = housing.tellg() ;
     housing.seekg(0,std::ios::beg) ;
     auto house = std::vector<std::uint8_t>(size,0) ;
     housing.read(reinterpret_cast<char*>(house.data()),house.size());
-    auto table = table_entry() ;
-    auto destsize = static_cast<uLong>(compressBound(static_cast<uLong>(house.size())));
-    auto dest = std::vector<std::uint8_t>(destsize,0) ;
-    auto srcsize = uLongf(house.size());
-    
-    auto status = compress(dest.data(), &destsize, house.data(), srcsize) ;
-    if (status != Z_OK) {
-        throw std::runtime_error("Error compressing data for housing entry"s );
-    }
-    dest.resize(destsize);
-    std::swap(dest,house) ;
-    table.decompressed_length = static_cast<std::uint32_t>(dest.size());
-    table.compressed_length = static_cast<std::uint32_t>(house.size());
-    table.identifier = housinghash ;
-    table.compression =1 ;
-    table.data_block_hash = hashAdler32(house);
-    table.offset = output.tellp() ;
-   
-    output.seekp(offset,std::ios::beg);
-    output.write(reinterpret_cast<char*>(house.data()),house.size());
-    offset = output.tellp();
-    output.seekp(offsets[count],std::ios::beg);
-    table.save(output);
-    output.seekp(offset,std::ios::beg) ;
 
+    // The workers parse, serialize and compress each csv
+    writeUOP(output, ids.size(), [&ids,&maker](std::size_t index){
+        return maker.make(ids[index].first, multi_t(ids[index].second).record(true)) ;
+    }, maker.house(house), jobs) ;
+}
+//====================================================================================
+auto multistorage_t::patchUOP(const std::filesystem::path &uopfile, std::uint32_t id, const multi_t &multi) ->void {
+    auto stream = std::fstream(uopfile.string(),std::ios::in|std::ios::out|std::ios::binary) ;
+    if (!stream.is_open()){
+        throw std::runtime_error("Unable to open: "s + uopfile.string()) ;
+    }
+    auto block = makeBlock(id, multi.record(true)) ;
+    writeUOPEntry(stream, block.entry, block.data.data(), block.data.size()) ;
 }
 //====================================================================================
-auto multistorage_t::saveMUL(const std::filesystem::path &csvdirectory, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile)->void {
-    auto entries = gatherTextMulti(csvdirectory) ;
+auto multistorage_t::removeUOP(const std::filesystem::path &uopfile, std::uint32_t id) ->bool {
+    auto stream = std::fstream(uopfile.string(),std::ios::in|std::ios::out|std::ios::binary) ;
+    if (!stream.is_open()){
+        throw std::runtime_error("Unable to open: "s + uopfile.string()) ;
+    }
+    return removeUOPEntry(stream, hashName(hashformat,id)) ;
+}
+//====================================================================================
+auto multistorage_t::saveMUL(const std::filesystem::path &csvdirectory, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs, bool incremental)->void {
+    auto entries = gatherTextMulti(csvdirectory,jobs) ;
     if (entries.empty()){
         throw std::runtime_error("No valid csv entries found at: "s + csvdirectory.string());
     }
-    auto maxid = (entries.rbegin()->first) + 1 ;
-    if (maxid < idxmax) {
-        maxid = idxmax ;
+    auto ids = std::vector<std::pair<std::uint32_t,std::filesystem::path>>(entries.begin(),entries.end()) ;
+    auto present = std::vector<std::uint32_t>() ;
+    present.reserve(ids.size()) ;
+    for (const auto &entry : ids){
+        present.push_back(entry.first) ;
     }
-    auto idx = std::ofstream(indexfile.string(),std::ios::binary);
-    if(!idx.is_open()){
-        throw std::runtime_error("Unable to create: "s+indexfile.string());
+    if (!incremental){
+        // The workers parse and serialize each csv
+        writeMUL(mulfile, indexfile, present, [&ids](std::size_t index){
+            return multi_t(ids[index].second).record(false) ;
+        }, jobs) ;
+        return ;
     }
-    auto mul = std::ofstream(mulfile.string(),std::ios::binary);
-    if(!mul.is_open()){
-        throw std::runtime_error("Unable to create: "s+mulfile.string());
+    // The manifest is kept with the mul, the records are copied from it
+    auto state = incremental_t(mulfile, ids.size()) ;
+    try {
+        writeMUL(manifest_t::temporaryPath(mulfile), manifest_t::temporaryPath(indexfile), present, [&ids,&state](std::size_t index){
+            return state.block(index, ids[index].first, ids[index].second, false, [](const std::string &text){
+                auto multi = multi_t() ;
+                csvComponents(text, multi.data) ;
+                auto rvalue = uopblock_t() ;
+                rvalue.data = multi.record(false) ;
+                return rvalue ;
+            }).data ;
+        }, jobs, idxmax, [&state](std::size_t index, const table_entry &entry){
+            state.records[index].second.entry = entry ;
+        }) ;
     }
-    auto length = std::uint32_t(0) ;
-    auto extra = std::uint32_t(0) ;
-    auto offset = std::uint32_t(0) ;
-    for (std::uint32_t id = 0 ; id < maxid;id++){
-        auto iter = entries.find(id) ;
-        if (iter != entries.end()){
-            auto multi = multi_t(iter->second) ;
-            auto muldata = multi.record(false) ;
-            offset = static_cast<std::uint32_t>(mul.tellp()) ;
-            mul.write(reinterpret_cast<char*>(muldata.data()),muldata.size());
-            auto length = static_cast<std::uint32_t>(muldata.size());
-            idx.write(reinterpret_cast<char*>(&offset),4);
-            idx.write(reinterpret_cast<char*>(&length), 4);
-            idx.write(reinterpret_cast<char*>(&extra),4);
-        }
-        else {
-            length = 0 ;
-            offset = 0xFFFFFFFF;
-            idx.write(reinterpret_cast<char*>(&offset),4);
-            idx.write(reinterpret_cast<char*>(&length), 4);
-            idx.write(reinterpret_cast<char*>(&offset),4);
-        }
+    catch(...){
+        replaceOutputs({mulfile,indexfile}, false) ;
+        throw ;
     }
+    state.output.close() ;
+    replaceOutputs({mulfile,indexfile}, true) ;
+    state.save(mulfile) ;
 }
 //====================================================================================
-auto multistorage_t::housing() const ->std::vector<std::uint8_t> {
-    auto offset = housing_location.offset + housing_location.header_length ;
-    auto data = std::vector<std::uint8_t>(housing_location.compressed_length,0) ;
-    datafile.seekg(offset,std::ios::beg);
-    datafile.read(reinterpret_cast<char*>(data.data()),data.size()) ;
-    if (housing_location.compression){
-        // uncompress the data!
-        auto temp = std::vector<std::uint8_t>(housing_location.decompressed_length,0) ;
-        
-        auto destsize = static_cast<uLong>(temp.size())  ;
-        auto srcsize = static_cast<uLong>(data.size()) ;
-        auto status = uncompress2(temp.data(), &destsize, data.data(), &srcsize);
-        if (status != Z_OK){
-            throw std::runtime_error("Decompression error");
-        }
-        std::swap(data,temp) ;
+auto multistorage_t::saveMUL(const bundle_t &bundle, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs)->void {
+    auto ids = bundle.ids() ;
+    if (ids.empty()){
+        throw std::runtime_error("There are no multi entries to save"s);
     }
-    return data ;
+    writeMUL(mulfile, indexfile, ids, [&bundle,&ids](std::size_t index){
+        return bundle[ids[index]].record(false) ;
+    }, jobs) ;
+}
+//====================================================================================
+auto multistorage_t::saveUOP(const bundle_t &bundle, const std::filesystem::path &uopfile, std::size_t jobs, const uopoptions_t &options)->void {
+    auto ids = bundle.ids() ;
+    auto housing = bundle.housing() ;
+    if (housing.empty()){
+        throw std::runtime_error(strutil::format("No housing.bin data provided, can not create: %s",uopfile.string().c_str()));
+    }
+    auto output = uopwriter_t(uopfile, static_cast<std::uint32_t>(ids.size()) + 1, options.dedup) ;
+    if (!output.is_open()){
+        throw std::runtime_error("Unable to create: "s + uopfile.string()) ;
+    }
+    auto maker = blockmaker_t(options) ;
+    writeUOP(output, ids.size(), [&bundle,&ids,&maker](std::size_t index){
+        return maker.make(ids[index], bundle[ids[index]].record(true)) ;
+    }, maker.house(std::vector<std::uint8_t>(housing.begin(),housing.end())), jobs) ;
+}
+//====================================================================================
+auto multistorage_t::saveMUL(const multistorage_t &source, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs)->void {
+    auto ids = source.nonempty() ;
+    if (ids.empty()){
+        throw std::runtime_error("There are no multi entries to save"s);
+    }
+    // The workers view and convert each entry, while the last ones are written
+    writeMUL(mulfile, indexfile, ids, [&source,&ids](std::size_t index){
+        return source.record(ids[index],false) ;
+    }, jobs) ;
+}
+//====================================================================================
+auto multistorage_t::saveUOP(const multistorage_t &source, const std::filesystem::path &uopfile, const std::vector<std::uint8_t> &housing, std::size_t jobs, const uopoptions_t &options)->void {
+    auto ids = source.nonempty() ;
+    if (ids.empty()){
+        throw std::runtime_error("There are no multi entries to save"s);
+    }
+    if (housing.empty()){
+        throw std::runtime_error(strutil::format("No housing.bin data provided, can not create: %s",uopfile.string().c_str()));
+    }
+    auto output = uopwriter_t(uopfile, static_cast<std::uint32_t>(ids.size()) + 1, options.dedup) ;
+    if (!output.is_open()){
+        throw std::runtime_error("Unable to create: "s + uopfile.string()) ;
+    }
+    // The workers view, convert and compress each entry, while the last ones are written
+    auto maker = blockmaker_t(options) ;
+    writeUOP(output, ids.size(), [&source,&ids,&maker](std::size_t index){
+        return maker.make(ids[index], source.record(ids[index],true)) ;
+    }, maker.house(housing), jobs) ;
 }
 //====================================================================================
-auto multistorage_t::save(const std::filesystem::path &datapath,const std::filesystem::path &idxpath,const std::vector<std::uint8_t> &housingdata ) ->void {
+auto multistorage_t::saveBundle(const std::filesystem::path &bundlefile) const ->void {
+    auto output = bundlewriter_t(bundlefile) ;
+    if (!output.is_open()){
+        throw std::runtime_error("Unable to create: "s + bundlefile.string()) ;
+    }
+    // One pass through the file, straight from the record bytes
+    extract([&output](std::uint32_t id, const multi_view_t &view){
+        if (!view.empty()){
+            output.add(id,view) ;
+        }
+    });
+    output.close(isuop ? housing() : std::vector<std::uint8_t>()) ;
+}
+//====================================================================================
+auto multistorage_t::housing() const ->std::vector<std::uint8_t> {
+    auto bytes = datafile.view(housing_location.offset + housing_location.header_length, housing_location.compressed_length) ;
+    return entryData(housing_location, bytes) ;
+}
+//====================================================================================
+auto multistorage_t::save(const std::filesystem::path &datapath,const std::filesystem::path &idxpath,const std::vector<std::uint8_t> &housingdata, std::size_t jobs ) ->void {
     if (!idxpath.empty()){
         // We are saving to a mul/idx
-        auto idx = std::ofstream(idxpath.string(),std::ios::binary) ;
-        if (!idx.is_open()){
-            throw std::runtime_error(strutil::format("Unable to create: %s",idxpath.string().c_str()));
-        }
-        auto mul = std::ofstream(datapath.string(),std::ios::binary);
-        if (!mul.is_open()){
-            throw std::runtime_error(strutil::format("Unable to create: %s",datapath.string().c_str()));
-        }
         if (entry_location.empty()){
             throw std::runtime_error("There are no multi entries to save"s);
         }
-        auto maxid = std::max(idxmax,static_cast<int>(entry_location.rbegin()->first)) ;
-        
-        auto length = std::uint32_t(0) ;
-        auto extra = std::uint32_t(0) ;
-        auto offset = std::uint32_t(0) ;
-        for (std::uint32_t id = 0 ; id < static_cast<std::uint32_t>(maxid);id++){
-            auto iter = entry_location.find(id) ;
-            if (iter != entry_location.end()){
-                auto multi = (*this)[id] ;
-                auto muldata = multi.record(false) ;
-                offset = static_cast<std::uint32_t>(mul.tellp()) ;
-                mul.write(reinterpret_cast<char*>(muldata.data()),muldata.size());
-                auto length = static_cast<std::uint32_t>(muldata.size());
-                idx.write(reinterpret_cast<char*>(&offset),4);
-                idx.write(reinterpret_cast<char*>(&length), 4);
-                idx.write(reinterpret_cast<char*>(&extra),4);
-            }
-            else {
-                length = 0 ;
-                offset = 0xFFFFFFFF;
-                
-                idx.write(reinterpret_cast<char*>(&offset),4);
-                idx.write(reinterpret_cast<char*>(&length), 4);
-                idx.write(reinterpret_cast<char*>(&offset),4);
-            }
-        }
+        auto maxid = static_cast<std::uint32_t>(std::max(idxmax,static_cast<int>(entry_location.maxid()))) ;
+        auto present = ids(false) ;
+        present.erase(std::lower_bound(present.begin(),present.end(),maxid),present.end()) ;
+        // The workers view and serialize each entry
+        writeMUL(datapath, idxpath, present, [this,&present](std::size_t index){
+            return record(present[index],false) ;
+        }, jobs, maxid) ;
      }
     else {
         // We are saving to a uop!
         if (housingdata.empty()){
             throw std::runtime_error(strutil::format("No housing.bin data provided, can not create: %s",datapath.string().c_str()));
         }
-        auto uop = std::ofstream(datapath.string(),std::ios::binary);
+        auto uop = uopwriter_t(datapath, static_cast<std::uint32_t>(entry_location.size()) + 1);
         if (!uop.is_open()){
             throw std::runtime_error(strutil::format("Unable to create: %s",datapath.string().c_str()));
         }
-        auto offsets = createUOP(uop, static_cast<std::uint32_t>(entry_location.size()) + 1) ;
-
-        auto offset = uop.tellp() ;
-        auto count = 0 ;
-        for (auto const &[id,entry_offset]:entry_location){
-            auto collection = (*this)[id] ;
-            auto data = collection.record(true) ;
-            auto table = table_entry() ;
-            table.decompressed_length = static_cast<std::uint32_t>(data.size()) ;
-            table.compression = 1 ;
-            auto destsize = static_cast<uLong>(compressBound(static_cast<uLong>(data.size())));
-            auto dest = std::vector<std::uint8_t>(destsize,0) ;
-            auto srcsize = uLongf(data.size());
-            
-            auto status = compress(dest.data(), &destsize, data.data(), srcsize) ;
-            if (status != Z_OK) {
-                throw std::runtime_error("Error compressing data for entry: "s + std::to_string(id));
-            }
-            dest.resize(destsize);
-            std::swap(dest,data) ;
-            table.compressed_length = static_cast<std::uint32_t>(data.size());
-            table.identifier = hashLittle2(strutil::format(hashformat,id));
-            table.data_block_hash = hashAdler32(data);
-            table.offset = uop.tellp() ;
-            uop.seekp(offset,std::ios::beg);
-            uop.write(reinterpret_cast<char*>(data.data()),data.size());
-            offset = uop.tellp();
-            uop.seekp(offsets[count],std::ios::beg);
-            table.save(uop);
-            uop.seekp(offset,std::ios::beg);
-            count++ ;
-        }
-        auto housedata = housingdata;
-        // Now we need to housing.bin
-        auto table = table_entry() ;
-        auto destsize = static_cast<uLong>(compressBound(static_cast<uLong>(housedata.size())));
-        auto dest = std::vector<std::uint8_t>(destsize,0) ;
-        auto srcsize = uLongf(housedata.size());
-        
-        auto status = compress(dest.data(), &destsize, housedata.data(), srcsize) ;
-        if (status != Z_OK) {
-            throw std::runtime_error("Error compressing data for housing entry"s );
-        }
-        dest.resize(destsize);
-        std::swap(dest,housedata) ;
-        table.decompressed_length = static_cast<std::uint32_t>(dest.size());
-        table.compressed_length = static_cast<std::uint32_t>(housedata.size());
-        table.identifier = housinghash ;
-        table.compression =1 ;
-        table.data_block_hash = hashAdler32(housedata);
-        table.offset = uop.tellp() ;
-        
-        uop.seekp(offset,std::ios::beg);
-        uop.write(reinterpret_cast<char*>(housedata.data()),housedata.size());
-        offset = uop.tellp();
-        uop.seekp(offsets[count],std::ios::beg);
-        table.save(uop);
-        uop.seekp(offset,std::ios::beg) ;
+        // The uop is in id order, the workers view, serialize and compress each entry
+        auto present = ids(false) ;
+        writeUOP(uop, present.size(), [this,&present](std::size_t index){
+            return makeBlock(present[index], record(present[index],true)) ;
+        }, makeBlock(housingid, housingdata), jobs) ;
    }
 }
@@ -5,14 +5,26 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <ostream>
 #include <map>
 #include <utility>
 #include <fstream>
 #include <filesystem>
+#include <iterator>
+#include <algorithm>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 #include "uop.hpp"
+#include "mapfile.hpp"
+#include "compressor.hpp"
 //=================================================================================
 //  multi_component_t ;
 //=================================================================================
@@ -26,21 +38,95 @@ struct multi_component_t {
     std::uint64_t flag ;
     std::vector<std::uint32_t> cliloc;
     multi_component_t():tileid(0xFFFF),offsetx(0),offsety(0),offsetz(0),flag(0){}
-    multi_component_t(const std::string &entry) ;
+    multi_component_t(std::string_view entry) ;
     auto operator<(const multi_component_t &value) const ->bool ;
     auto description() const ->std::string ;
+    // Appends the description to output
+    auto description(std::string &output) const ->void ;
     auto loaduop(const std::uint8_t *data) ->int ;
     auto loadmul(const std::uint8_t *data) ->int ;
     auto data(bool isuop = true) const ->std::vector<std::uint8_t> ;
 };
 //=================================================================================
+//  component_view_t ;
+//=================================================================================
+// A read only accessor for one component, decoded on request straight from the
+// record bytes (uop or mul format).  Nothing is copied, so it is only valid as long
+// as the bytes are.
+//=================================================================================
+class component_view_t {
+    const std::uint8_t *ptr ;
+    bool isuop ;
+    template <typename T>
+    auto value(std::size_t offset) const ->T {
+        auto rvalue = T(0) ;
+        std::copy(ptr+offset,ptr+offset+sizeof(T),reinterpret_cast<std::uint8_t*>(&rvalue));
+        return rvalue ;
+    }
+public:
+    component_view_t(const std::uint8_t *ptr, bool isuop):ptr(ptr),isuop(isuop){}
+    auto tileid() const ->std::uint16_t { return value<std::uint16_t>(0);}
+    auto offsetx() const ->std::int16_t { return value<std::int16_t>(2);}
+    auto offsety() const ->std::int16_t { return value<std::int16_t>(4);}
+    auto offsetz() const ->std::int16_t { return value<std::int16_t>(6);}
+    // The flag as a mul flag (the uop flag is converted the same as multi_component_t)
+    auto flag() const ->std::uint64_t ;
+    auto clilocCount() const ->std::uint32_t { return isuop ? value<std::uint32_t>(10) : 0;}
+    auto cliloc(std::uint32_t index) const ->std::uint32_t { return value<std::uint32_t>(14 + static_cast<std::size_t>(index) * 4);}
+    // The number of bytes the component takes in the record
+    auto size() const ->std::size_t ;
+    // An owning, editable copy
+    auto component() const ->multi_component_t ;
+};
+//=================================================================================
+//  multi_view_t ;
+//=================================================================================
+// A non owning view of a multi record (a decompressed uop entry, or mul data), that
+// iterates the components without decoding (or allocating) anything.  As with multi_t,
+// the record bytes are trusted to hold the number of components they claim.
+//=================================================================================
+class multi_view_t {
+    const std::uint8_t *ptr ;
+    std::size_t count ;
+    bool isuop ;
+public:
+    class iterator {
+        const std::uint8_t *ptr ;
+        std::size_t index ;
+        bool isuop ;
+    public:
+        using iterator_category = std::forward_iterator_tag ;
+        using value_type = component_view_t ;
+        using difference_type = std::ptrdiff_t ;
+        using pointer = void ;
+        using reference = component_view_t ;
+        iterator(const std::uint8_t *ptr, std::size_t index, bool isuop):ptr(ptr),index(index),isuop(isuop){}
+        auto operator*() const ->component_view_t { return component_view_t(ptr,isuop);}
+        auto operator++() ->iterator& ;
+        auto operator++(int) ->iterator { auto rvalue = *this; ++(*this); return rvalue;}
+        auto operator==(const iterator &value) const ->bool { return index == value.index;}
+        auto operator!=(const iterator &value) const ->bool { return index != value.index;}
+    };
+    multi_view_t():ptr(nullptr),count(0),isuop(true){}
+    multi_view_t(const std::uint8_t *bytes, std::size_t size, bool isuop) ;
+    auto size() const ->std::size_t { return count;}
+    auto empty() const ->bool { return count == 0;}
+    auto uop() const ->bool { return isuop;}
+    auto begin() const ->iterator ;
+    auto end() const ->iterator { return iterator(nullptr,count,isuop);}
+    // The record in either format (the same bytes as multi_t(view).record(touop)),
+    // converting each component through multi_component_t::data
+    auto record(bool touop) const ->std::vector<std::uint8_t> ;
+};
 //=================================================================================
 //  multi_t ;
 //=================================================================================
 struct multi_t {
     std::vector<multi_component_t> data ;
     multi_t() = default ;
+    multi_t(const multi_view_t &view) ;
     multi_t(const std::vector<std::uint8_t> &bytes, bool isuop) ;
+    multi_t(const std::uint8_t *bytes, std::size_t size, bool isuop) ;
     multi_t(std::vector<std::string> text) ;
     multi_t(const std::filesystem::path &csvfile);
     auto size() const ->std::int32_t ;
@@ -51,33 +137,192 @@ struct multi_t {
     auto description(std::ostream &output) const ->void ;
 };
 //=================================================================================
+//  multicache_t ;
+//=================================================================================
+// A least recently used cache of decompressed entries, holding at most budget bytes
+// of entry data. Safe to use from any number of threads.
+//=================================================================================
+struct cachestats_t {
+    std::uint64_t hits ;
+    std::uint64_t misses ;
+    std::size_t entries ;
+    std::size_t bytes ;
+    std::size_t budget ;
+};
+class multicache_t {
+public:
+    using data_t = std::shared_ptr<const std::vector<std::uint8_t>> ;
+private:
+    struct item_t {
+        std::uint32_t id ;
+        data_t data ;
+    };
+    mutable std::mutex lock ;
+    std::list<item_t> items ;     // most recently used first
+    std::unordered_map<std::uint32_t,std::list<item_t>::iterator> lookup ;
+    std::size_t budget ;
+    std::size_t used ;
+    std::atomic<std::uint64_t> hits ;
+    std::atomic<std::uint64_t> misses ;
+public:
+    multicache_t(std::size_t budget) ;
+    // nullptr if not in the cache
+    auto find(std::uint32_t id) ->data_t ;
+    // Data larger than the budget is not kept
+    auto insert(std::uint32_t id, data_t data) ->void ;
+    auto clear() ->void ;
+    auto statistics() const ->cachestats_t ;
+};
+//=================================================================================
+//  entrylocation_t ;
+//=================================================================================
+// Just the parts of a table entry needed to find and read its data (24 bytes, rather
+// than a full table_entry, the identifier and block hash are of no use once loaded)
+//=================================================================================
+struct entrylocation_t {
+    std::uint64_t offset ;
+    std::uint32_t header_length ;
+    std::uint32_t compressed_length ;
+    std::uint32_t decompressed_length ;
+    std::int16_t compression ;
+    entrylocation_t():offset(0),header_length(0),compressed_length(0),decompressed_length(0),compression(0){}
+    explicit entrylocation_t(const table_entry &entry):offset(entry.offset),header_length(entry.header_length),compressed_length(entry.compressed_length),decompressed_length(entry.decompressed_length),compression(entry.compression){}
+};
+//=================================================================================
+//  entrytable_t ;
+//=================================================================================
+// The locations of the multis, indexed by id.  Ids are small and dense, so a
+// lookup is just an index into a vector of slots, which point into the packed
+// entries (so an absent id only costs a slot).  Iterating gives the present ids in
+// increasing order.
+//=================================================================================
+class entrytable_t {
+    static constexpr auto absent = std::uint32_t(0xFFFFFFFF) ;
+    std::vector<std::uint32_t> slots ;
+    std::vector<entrylocation_t> entries ;
+public:
+    class iterator {
+        const std::vector<std::uint32_t> *slots ;
+        std::size_t id ;
+        auto skip() ->void { while ((id < slots->size()) && ((*slots)[id] == absent)) { id++ ;}}
+    public:
+        using iterator_category = std::forward_iterator_tag ;
+        using value_type = std::uint32_t ;
+        using difference_type = std::ptrdiff_t ;
+        using pointer = void ;
+        using reference = std::uint32_t ;
+        iterator(const std::vector<std::uint32_t> *slots, std::size_t id):slots(slots),id(id){ skip();}
+        auto operator*() const ->std::uint32_t { return static_cast<std::uint32_t>(id);}
+        auto operator++() ->iterator& { id++ ; skip(); return *this;}
+        auto operator++(int) ->iterator { auto rvalue = *this; ++(*this); return rvalue;}
+        auto operator==(const iterator &value) const ->bool { return id == value.id;}
+        auto operator!=(const iterator &value) const ->bool { return id != value.id;}
+    };
+    auto clear() ->void { slots.clear(); entries.clear();}
+    auto reserve(std::size_t amount) ->void { entries.reserve(amount);}
+    auto insert(std::uint32_t id, const table_entry &entry) ->void ;
+    // nullptr if the id is not present
+    auto find(std::uint32_t id) const ->const entrylocation_t* {
+        return ((id < slots.size()) && (slots[id] != absent)) ? &entries[slots[id]] : nullptr ;
+    }
+    auto contains(std::uint32_t id) const ->bool { return find(id) != nullptr;}
+    auto size() const ->std::size_t { return entries.size();}
+    auto empty() const ->bool { return entries.empty();}
+    // The largest present id (0 if empty)
+    auto maxid() const ->std::uint32_t { return slots.empty() ? 0 : static_cast<std::uint32_t>(slots.size() - 1);}
+    auto begin() const ->iterator { return iterator(&slots,0);}
+    auto end() const ->iterator { return iterator(&slots,slots.size());}
+};
+//=================================================================================
+// How the entries of a uop being created are written
+//=================================================================================
+struct uopoptions_t {
+    bool dedup ;                        // store identical multis once (see uopwriter_t)
+    compressionpolicy_t compression ;   // how each entry is compressed
+    uopoptions_t():dedup(false){}
+};
+class bundle_t ;
+//=================================================================================
 //  multistorage_t ;
 //=================================================================================
 class multistorage_t {
 private:
-    table_entry housing_location ;
-    std::map<std::uint32_t,table_entry> entry_location ;
+    entrylocation_t housing_location ;
+    entrytable_t entry_location ;
     
-    mutable std::ifstream datafile ;
+    // The data file is memory mapped, lookups only read from it, so
+    // any number of threads can request entries at the same time
+    mappedfile_t datafile ;
     std::filesystem::path indexfile ;
     bool isuop ;
+    std::unique_ptr<multicache_t> cache ;
     
     
     auto retrieve_uopaccess(std::ifstream &uopfile) ->void ;
-    auto retrieve_idxaccess(std::ifstream  &idxfile) ->void ;
-    static auto gatherTextMulti(const std::filesystem::path &path)  -> std::map<std::uint32_t,std::filesystem::path> ;
+    auto retrieve_idxaccess(const mappedfile_t &idxfile) ->void ;
+    static auto gatherTextMulti(const std::filesystem::path &path, std::size_t jobs = 0)  -> std::map<std::uint32_t,std::filesystem::path> ;
+    // The ids (in id order) that have at least one component, those extract hands
+    // a non empty view
+    auto nonempty() const ->std::vector<std::uint32_t> ;
+    // The record for an id in either format, read through a view (thread safe)
+    auto record(std::uint32_t id, bool touop) const ->std::vector<std::uint8_t> ;
 
 public:
-    static auto saveUOP(const std::filesystem::path &csvdirectory ,const std::filesystem::path &uopfile, const std::filesystem::path &housingpath=std::filesystem::path("housing.bin"))->void ;
-    static auto saveMUL(const std::filesystem::path &csvdirectory, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile)->void ;
+    // jobs is the number of threads to use (0 is one per core)
+    // incremental keeps a manifest next to the output (see manifest.hpp), and only parses
+    // and compresses the csv files changed since it was written, the blocks of the rest
+    // are copied from the old output.  The output is the same either way.
+    // options.dedup stores identical multis in a uop once (their table entries all point
+    // at the one block), and only compresses them once
+    static auto saveUOP(const std::filesystem::path &csvdirectory ,const std::filesystem::path &uopfile, const std::filesystem::path &housingpath=std::filesystem::path("housing.bin"), std::size_t jobs = 0, bool incremental = false, const uopoptions_t &options = uopoptions_t())->void ;
+    static auto saveMUL(const std::filesystem::path &csvdirectory, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs = 0, bool incremental = false)->void ;
+    // The same, from a bundle (the uop needs the bundle to have housing.bin)
+    static auto saveUOP(const bundle_t &bundle, const std::filesystem::path &uopfile, std::size_t jobs = 0, const uopoptions_t &options = uopoptions_t())->void ;
+    static auto saveMUL(const bundle_t &bundle, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs = 0)->void ;
+    // The same, straight from another opened uop or mul (converting between them).
+    // The result matches extracting the source to csv files and creating from those
+    static auto saveUOP(const multistorage_t &source, const std::filesystem::path &uopfile, const std::vector<std::uint8_t> &housing, std::size_t jobs = 0, const uopoptions_t &options = uopoptions_t())->void ;
+    static auto saveMUL(const multistorage_t &source, const std::filesystem::path &mulfile, const std::filesystem::path &indexfile, std::size_t jobs = 0)->void ;
+    // Replace (or add) and remove a single multi in an existing uop, in place.  Any
+    // multistorage_t that has the uop open should be reloaded afterwards
+    static auto patchUOP(const std::filesystem::path &uopfile, std::uint32_t id, const multi_t &multi) ->void ;
+    static auto removeUOP(const std::filesystem::path &uopfile, std::uint32_t id) ->bool ;
+    // Where the hashes of the multi ids (needed to open a uop) are cached between runs,
+    // read if valid, and otherwise built and written there.  Empty (the default) builds
+    // them without a cache.  Only takes effect if set before the first uop is opened
+    static auto hashCache(const std::filesystem::path &cachepath) ->void ;
     multistorage_t(const std::filesystem::path &datafile, const std::filesystem::path &indexfile=std::filesystem::path()) ;
     multistorage_t()=default ;
     auto uop() const ->bool {return isuop;}
     auto maxid() const ->std::uint32_t ;
+    // The ids that are present, in the order their data is in the file (so reading
+    // them in turn is sequential), or in id order
+    auto ids(bool fileorder = true) const ->std::vector<std::uint32_t> ;
     auto saveHousing(const std::filesystem::path &filepath) const ->void ;
+    // Writes every multi (and housing.bin for a uop) to a bundle
+    auto saveBundle(const std::filesystem::path &bundlefile) const ->void ;
     auto housing() const ->std::vector<std::uint8_t> ;
-    auto save(const std::filesystem::path &datapath,const std::filesystem::path &idxpath=std::filesystem::path(),const std::vector<std::uint8_t> &housingdata = std::vector<std::uint8_t>()) ->void ;
+    // The raw bytes (as stored, so possibly compressed) of an entry in the mapping,
+    // empty if the entry is not present
+    auto entry(std::uint32_t index) const ->byteview_t ;
+    // A view of an entry without decoding it.  Uncompressed entries are viewed in the
+    // mapping, compressed ones are uncompressed into scratch (reused between calls), so
+    // the view is valid until scratch changes. Empty if the entry is not present
+    auto view(std::uint32_t index, std::vector<std::uint8_t> &scratch) const ->multi_view_t ;
+    auto save(const std::filesystem::path &datapath,const std::filesystem::path &idxpath=std::filesystem::path(),const std::vector<std::uint8_t> &housingdata = std::vector<std::uint8_t>(), std::size_t jobs = 0) ->void ;
     auto operator[](std::uint32_t index) const -> multi_t ;
+    // Keep up to budget bytes of decompressed entries for operator[] (0 turns the cache
+    // off). Lookups are thread safe with the cache on, but this is not, so set it up
+    // before sharing the storage between threads
+    auto enableCache(std::size_t budget) ->void ;
+    // Visits every present entry in file order, reading the data front to back (with
+    // read ahead), so the whole file is processed at sequential read speed.  The view
+    // is only valid during the call to sink, and may be empty (for an empty entry).
+    // With more than one job, entries are handed to sink on that many threads (still
+    // taken in file order, but they can finish in any order), so sink must be thread safe
+    static constexpr auto bulk_chunk = std::uint64_t(4 * 1024 * 1024) ;
+    auto extract(const std::function<void(std::uint32_t,const multi_view_t&)> &sink, std::size_t jobs = 1) const ->void ;
+    auto cacheStatistics() const ->cachestats_t ;
 };
 
 
@@ -0,0 +1,177 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+//=================================================================================
+// Helpers for spreading work over threads
+//=================================================================================
+
+//=================================================================================
+// The number of threads to use for a requested job count (0 means one per core).
+// More then four a core only costs memory and switching, so it is capped there
+inline auto jobCount(std::size_t jobs) ->std::size_t {
+    auto cores = std::max(static_cast<std::size_t>(std::thread::hardware_concurrency()),std::size_t(1)) ;
+    if (jobs == 0){
+        jobs = cores ;
+    }
+    return std::min(jobs,cores * 4) ;
+}
+
+//=================================================================================
+// Runs produce(index) for every index in [0,count) on worker threads, and hands each
+// result to consume(index,result) on the calling thread in index order. Workers are
+// only allowed a few results ahead of consume, so memory stays bounded. If produce or
+// consume throws, the work is stopped and the exception is rethrown to the caller.
+// Result must be default constructible and movable.
+template <typename Result, typename Produce, typename Consume>
+auto orderedParallel(std::size_t count, std::size_t jobs, Produce &&produce, Consume &&consume) ->void {
+    jobs = std::min(jobCount(jobs),std::max(count,std::size_t(1))) ;
+    if (jobs == 1){
+        // No point in threads, just do it here
+        for (std::size_t index = 0 ; index < count ; index++){
+            consume(index,produce(index));
+        }
+        return ;
+    }
+    const auto window = jobs * 4 ;
+    auto results = std::vector<Result>(window) ;
+    auto ready = std::vector<bool>(window,false) ;
+    auto lock = std::mutex() ;
+    auto signal = std::condition_variable() ;
+    auto next = std::size_t(0) ;        // the next index for a worker to take
+    auto consumed = std::size_t(0) ;    // how many results consume has had
+    auto stop = false ;
+    auto error = std::exception_ptr() ;
+
+    auto worker = [&](){
+        try {
+            while (true){
+                auto index = std::size_t(0) ;
+                {
+                    auto guard = std::unique_lock<std::mutex>(lock) ;
+                    signal.wait(guard,[&](){ return stop || (next >= count) || (next < consumed + window);});
+                    if (stop || (next >= count)){
+                        return ;
+                    }
+                    index = next++ ;
+                }
+                auto result = produce(index) ;
+                {
+                    auto guard = std::lock_guard<std::mutex>(lock) ;
+                    results[index % window] = std::move(result) ;
+                    ready[index % window] = true ;
+                }
+                signal.notify_all() ;
+            }
+        }
+        catch(...){
+            auto guard = std::lock_guard<std::mutex>(lock) ;
+            if (!error){
+                error = std::current_exception() ;
+            }
+            stop = true ;
+            signal.notify_all() ;
+        }
+    };
+    auto threads = std::vector<std::thread>() ;
+    for (std::size_t j = 0 ; j < jobs ; j++){
+        threads.emplace_back(worker) ;
+    }
+    try {
+        for (std::size_t index = 0 ; index < count ; index++){
+            auto result = Result() ;
+            {
+                auto guard = std::unique_lock<std::mutex>(lock) ;
+                signal.wait(guard,[&](){ return stop || ready[index % window];});
+                if (stop){
+                    break;
+                }
+                result = std::move(results[index % window]) ;
+                results[index % window] = Result() ;
+                ready[index % window] = false ;
+                consumed++ ;
+            }
+            signal.notify_all() ;
+            consume(index,std::move(result));
+        }
+    }
+    catch(...){
+        auto guard = std::lock_guard<std::mutex>(lock) ;
+        if (!error){
+            error = std::current_exception() ;
+        }
+        stop = true ;
+    }
+    {
+        auto guard = std::lock_guard<std::mutex>(lock) ;
+        stop = true ;
+    }
+    signal.notify_all() ;
+    for (auto &thread : threads){
+        thread.join() ;
+    }
+    if (error){
+        std::rethrow_exception(error) ;
+    }
+}
+
+//=================================================================================
+// Runs func(index,worker) for every index in [0,count) on worker threads, in no
+// particular order (indexes are handed out in increasing order). worker is the number
+// (less than jobCount(jobs)) of the thread running it, for per thread state. If func
+// throws, no more indexes are handed out and the exception is rethrown to the caller.
+template <typename Func>
+auto parallelFor(std::size_t count, std::size_t jobs, Func &&func) ->void {
+    jobs = std::min(jobCount(jobs),std::max(count,std::size_t(1))) ;
+    if (jobs == 1){
+        for (std::size_t index = 0 ; index < count ; index++){
+            func(index,std::size_t(0));
+        }
+        return ;
+    }
+    auto next = std::atomic<std::size_t>(0) ;
+    auto stop = std::atomic<bool>(false) ;
+    auto lock = std::mutex() ;
+    auto error = std::exception_ptr() ;
+    auto worker = [&](std::size_t number){
+        try {
+            while (!stop){
+                auto index = next++ ;
+                if (index >= count){
+                    return ;
+                }
+                func(index,number) ;
+            }
+        }
+        catch(...){
+            auto guard = std::lock_guard<std::mutex>(lock) ;
+            if (!error){
+                error = std::current_exception() ;
+            }
+            stop = true ;
+        }
+    };
+    auto threads = std::vector<std::thread>() ;
+    for (std::size_t j = 0 ; j < jobs ; j++){
+        threads.emplace_back(worker,j) ;
+    }
+    for (auto &thread : threads){
+        thread.join() ;
+    }
+    if (error){
+        std::rethrow_exception(error) ;
+    }
+}
+
+#endif /* parallel_hpp */
@@ -3,6 +3,8 @@
 #include "uop.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std::string_literals;
 
@@ -22,6 +24,9 @@ constexpr	auto starting_offset = std::uint64_t(512) ;
 // Define the default table_size
 constexpr   auto default_table_size  = std::uint32_t(1000) ;
 
+// Where the number of entries is in the header
+constexpr	auto entry_count_location = std::uint32_t(24) ;
+
 //=================================================================================
 //=================================================================================
 table_entry::table_entry():offset(0),header_length(0),compressed_length(0),decompressed_length(0),identifier(0),data_block_hash(0),compression(0) {
@@ -42,6 +47,28 @@ auto table_entry::load(std::istream &input) ->table_entry & {
 	return *this ;
 }
 //=================================================================================
+auto table_entry::load(const std::uint8_t *data) ->table_entry & {
+	std::copy(data,data+8,reinterpret_cast<std::uint8_t*>(&offset));
+	std::copy(data+8,data+12,reinterpret_cast<std::uint8_t*>(&header_length));
+	std::copy(data+12,data+16,reinterpret_cast<std::uint8_t*>(&compressed_length));
+	std::copy(data+16,data+20,reinterpret_cast<std::uint8_t*>(&decompressed_length));
+	std::copy(data+20,data+28,reinterpret_cast<std::uint8_t*>(&identifier));
+	std::copy(data+28,data+32,reinterpret_cast<std::uint8_t*>(&data_block_hash));
+	std::copy(data+32,data+34,reinterpret_cast<std::uint8_t*>(&compression));
+	return *this ;
+}
+//=================================================================================
+auto table_entry::save(std::uint8_t *data) const ->const table_entry & {
+	std::copy(reinterpret_cast<const std::uint8_t*>(&offset),reinterpret_cast<const std::uint8_t*>(&offset)+8,data);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&header_length),reinterpret_cast<const std::uint8_t*>(&header_length)+4,data+8);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&compressed_length),reinterpret_cast<const std::uint8_t*>(&compressed_length)+4,data+12);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&decompressed_length),reinterpret_cast<const std::uint8_t*>(&decompressed_length)+4,data+16);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&identifier),reinterpret_cast<const std::uint8_t*>(&identifier)+8,data+20);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&data_block_hash),reinterpret_cast<const std::uint8_t*>(&data_block_hash)+4,data+28);
+	std::copy(reinterpret_cast<const std::uint8_t*>(&compression),reinterpret_cast<const std::uint8_t*>(&compression)+2,data+32);
+	return *this ;
+}
+//=================================================================================
 auto table_entry::save(std::ostream &output) ->table_entry & {
 	output.write(reinterpret_cast<char*>(&offset),sizeof(offset));
 	output.write(reinterpret_cast<char*>(&header_length),sizeof(header_length));
@@ -115,6 +142,71 @@ auto gatherEntryOffsets(std::istream &input) ->std::vector<std::uint64_t>{
 	return rvalue ;
 }
 
+//=========================================================================================
+auto gatherTableEntries(std::istream &input) ->std::vector<table_entry> {
+	auto rvalue = std::vector<table_entry>() ;
+	if (input.good()){
+		auto current = input.tellg() ;
+		input.seekg(0,std::ios::end);
+		auto filesize = static_cast<std::uint64_t>(input.tellg()) ;
+		input.seekg(table_offset_location,std::ios::beg);
+		
+		auto location = std::uint64_t(0) ;
+		auto expected = std::uint32_t(0) ;
+		input.read(reinterpret_cast<char*>(&location),sizeof(location));
+		// The header tells us the size of the tables, so we can normally get the
+		// table header and all its entries in one read.  It is only a hint (createUOP
+		// always says 1000, however many entries there are)
+		input.read(reinterpret_cast<char*>(&expected),sizeof(expected));
+		
+		constexpr auto header_size = std::uint64_t(12) ;	// tablesize and next location
+		// Nothing in the file can hold more entries then fit in it
+		auto maximum = filesize / table_entry::entry_size ;
+		auto buffer = std::vector<std::uint8_t>() ;
+		auto tablesize = std::uint32_t(0);
+		while ((location != 0) && input.good()) {
+			// Never read past the end of the file, whatever the header says
+			auto available = (location + header_size < filesize) ? (filesize - location - header_size) / table_entry::entry_size : std::uint64_t(0) ;
+			buffer.resize(header_size + std::min(static_cast<std::uint64_t>(expected), available) * table_entry::entry_size) ;
+			input.seekg(location,std::ios::beg) ;
+			input.read(reinterpret_cast<char*>(buffer.data()),buffer.size());
+			auto amount = static_cast<std::uint64_t>(input.gcount()) ;
+			if (amount < header_size){
+				break;
+			}
+			// If the table was at the end of the file, we may have come up short
+			input.clear() ;
+			std::copy(buffer.data(),buffer.data()+4,reinterpret_cast<std::uint8_t*>(&tablesize));
+			std::copy(buffer.data()+4,buffer.data()+header_size,reinterpret_cast<std::uint8_t*>(&location));
+			// A table can't have more entries then fit in the rest of the file, nor the
+			// tables together more then fit in the file (which also stops tables that
+			// link back on themselves)
+			if (static_cast<std::uint64_t>(tablesize) > available){
+				throw std::runtime_error("Invalid uop, table larger then the file: "s + std::to_string(tablesize));
+			}
+			if (static_cast<std::uint64_t>(tablesize) > maximum - rvalue.size()){
+				throw std::runtime_error("Invalid uop, tables larger then the file: "s + std::to_string(tablesize));
+			}
+			auto needed = header_size + static_cast<std::uint64_t>(tablesize) * table_entry::entry_size ;
+			if (needed > amount){
+				// Bigger then the header said, so get the rest
+				buffer.resize(needed) ;
+				input.read(reinterpret_cast<char*>(buffer.data()+amount),needed - amount);
+				if (static_cast<std::uint64_t>(input.gcount()) != needed - amount){
+					break;
+				}
+			}
+			auto entry = table_entry() ;
+			for (std::uint32_t j=0 ; j < tablesize;j++){
+				rvalue.push_back(entry.load(buffer.data() + header_size + static_cast<std::uint64_t>(j) * table_entry::entry_size));
+			}
+		}
+		input.clear() ;
+		input.seekg(current,std::ios::beg);
+	}
+	return rvalue ;
+}
+
 //=========================================================================================
 auto createUOP(std::ostream &output, std::uint32_t numentries) ->std::vector<std::uint64_t> {
 	auto rvalue = std::vector<std::uint64_t>() ;
@@ -169,29 +261,108 @@ auto createUOP(std::ostream &output, std::uint32_t numentries) ->std::vector<std
 
 }
 
+//=========================================================================================
+//  uopwriter_t
+//=========================================================================================
+//=========================================================================================
+uopwriter_t::uopwriter_t(const std::filesystem::path &path, std::uint32_t numentries, bool dedup):filepath(path),location(0),dedup(dedup) {
+	// The buffer has to be set before the file is opened to take effect
+	buffer.resize(buffer_size) ;
+	output.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+	// Opened for reading as well, so dedup can read back what it has written
+	output.open(path.string(),std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+	if (output.is_open()){
+		offsets = createUOP(output, numentries) ;
+		entries.reserve(offsets.size()) ;
+		location = static_cast<std::uint64_t>(output.tellp()) ;
+	}
+}
+//=========================================================================================
+auto uopwriter_t::is_open() const ->bool {
+	return output.is_open() ;
+}
+//=========================================================================================
+auto uopwriter_t::add(table_entry entry, const std::uint8_t *data, std::size_t size) ->std::uint64_t {
+	if (entries.size() >= offsets.size()){
+		throw std::runtime_error("More entries added than the uop was created for"s);
+	}
+	if (dedup){
+		auto key = hashLittle2(std::string_view(reinterpret_cast<const char*>(data),size)) ;
+		auto [first,last] = written.equal_range(key) ;
+		for ( ; first != last ; ++first){
+			if (matches(first->second,entry.data_block_hash,data,size)){
+				entry.offset = first->second.offset ;
+				entries.push_back(entry) ;
+				return entry.offset ;
+			}
+		}
+		written.emplace(key,block_t{location,size,entry.data_block_hash}) ;
+	}
+	entry.offset = location ;
+	output.write(reinterpret_cast<const char*>(data),size);
+	location += size ;
+	entries.push_back(entry) ;
+	return entry.offset ;
+}
+//=========================================================================================
+auto uopwriter_t::matches(const block_t &block, std::uint32_t data_block_hash, const std::uint8_t *data, std::size_t size) ->bool {
+	if ((block.size != size) || (block.data_block_hash != data_block_hash)){
+		return false ;
+	}
+	// Anything still buffered has to be in the file before it can be read back.  If
+	// that fails, the error is left for close to report
+	output.flush() ;
+	if (!output.good()){
+		return false ;
+	}
+	check.resize(size) ;
+	output.seekg(block.offset,std::ios::beg) ;
+	output.read(reinterpret_cast<char*>(check.data()),check.size());
+	auto same = (output.gcount() == static_cast<std::streamsize>(size)) && std::equal(check.begin(),check.end(),data) ;
+	output.clear() ;
+	output.seekp(location,std::ios::beg) ;
+	return same ;
+}
+//=========================================================================================
+auto uopwriter_t::close() ->void {
+	if (output.is_open()){
+		// The entries in a table are contiguous, so each table is one write.  Any
+		// entries never added are left as written by createUOP
+		auto table = std::vector<std::uint8_t>() ;
+		for (std::size_t start = 0 ; start < entries.size() ; start += default_table_size){
+			auto amount = std::min(entries.size() - start, static_cast<std::size_t>(default_table_size)) ;
+			table.resize(amount * table_entry::entry_size) ;
+			for (std::size_t j = 0 ; j < amount ; j++){
+				entries[start + j].save(table.data() + j * table_entry::entry_size) ;
+			}
+			output.seekp(offsets[start],std::ios::beg) ;
+			output.write(reinterpret_cast<char*>(table.data()),table.size());
+		}
+		// A failed write (a full disk say) has to be reported, not left as a short file
+		output.flush() ;
+		auto good = output.good() ;
+		output.close() ;
+		if (!good || output.fail()){
+			throw std::runtime_error("Unable to write: "s + filepath.string());
+		}
+	}
+}
+
 //=========================================================================================================================================
-auto createIDTableMapping(std::istream &input, const hashset_t &hashmapping, const std::vector<std::uint64_t> &offsets ) ->std::map<std::uint32_t,table_entry> {
+auto createIDTableMapping(std::istream &input, const hashset_t &hashmapping) ->std::map<std::uint32_t,table_entry> {
 	auto rvalue = std::map<std::uint32_t,table_entry>();
-	if (input.good()){
-		auto current = static_cast<std::uint64_t>(input.tellg());
-		for (auto offset : offsets){
-			input.seekg(offset,std::ios::beg);
-			auto entry = table_entry(input) ;
-			if (entry.valid()){
-				try {
-					auto id = hashmapping[entry.identifier] ;
-					rvalue.insert_or_assign(id, entry);
-				}
-				catch(...) {
-					// That hash wasnt in the mapping, so skip it
-				}
-			}
-			// Do we really need to keep reading if we found all the entries in the hashmapping?
-			if (hashmapping.size() == rvalue.size()){
-				break;
+	for (const auto &entry : gatherTableEntries(input)){
+		if (entry.valid()){
+			// If the hash isnt in the mapping, we skip it
+			auto id = hashmapping.find(entry.identifier) ;
+			if (id != nullptr){
+				rvalue.insert_or_assign(*id, entry);
 			}
 		}
-		input.seekg(current,std::ios::beg);
+		// Do we really need to keep reading if we found all the entries in the hashmapping?
+		if (hashmapping.size() == rvalue.size()){
+			break;
+		}
 	}
 	return rvalue ;
 }
@@ -200,17 +371,134 @@ auto createIDTableMapping(std::istream &input, const hashset_t &hashmapping, con
 // Update the hashes
 auto updateBlockHash(std::iostream &stream) ->void{
 	if (validUOP(stream)){
-		auto entries = gatherEntryOffsets(stream);
-		for (auto offset:entries){
-			stream.seekg(offset,std::ios::beg) ;
-			
-			auto entry = table_entry(stream) ;
+		auto entries = gatherTableEntries(stream);
+		auto offsets = gatherEntryOffsets(stream);
+		for (std::size_t j = 0 ; j < std::min(entries.size(),offsets.size()) ; j++){
+			auto &entry = entries[j] ;
 			if (entry.valid()){
 				stream.seekg(entry.offset+entry.header_length,std::ios::beg);
 				entry.data_block_hash = hashAdler32(stream, entry.compressed_length) ;
-				stream.seekp(offset,std::ios::beg);
+				stream.seekp(offsets[j],std::ios::beg);
 				entry.save(stream) ;
 			}
 		}
 	}
 }
+
+//=========================================================================================
+// Find the index of the entry with the identifier, or entries.size() if not present
+static auto findEntry(const std::vector<table_entry> &entries, std::uint64_t identifier) ->std::size_t {
+	for (std::size_t j = 0 ; j < entries.size() ; j++){
+		if (entries[j].valid() && (entries[j].identifier == identifier)){
+			return j ;
+		}
+	}
+	return entries.size() ;
+}
+//=========================================================================================
+static auto adjustEntryCount(std::iostream &stream, std::int32_t amount) ->void {
+	auto count = std::uint32_t(0) ;
+	stream.seekg(entry_count_location,std::ios::beg);
+	stream.read(reinterpret_cast<char*>(&count),sizeof(count));
+	count = static_cast<std::uint32_t>(static_cast<std::int64_t>(count) + amount) ;
+	stream.seekp(entry_count_location,std::ios::beg);
+	stream.write(reinterpret_cast<char*>(&count),sizeof(count));
+}
+//=========================================================================================
+// Adds an empty table to the end of the file, and links it to the last table.
+// Returns the offset of the first entry in it
+static auto appendTable(std::iostream &stream) ->std::uint64_t {
+	// Find where the link to the new table goes (the next location of the last table,
+	// or the first table offset in the header if there are none)
+	auto link = std::uint64_t(table_offset_location) ;
+	auto location = std::uint64_t(0) ;
+	stream.seekg(link,std::ios::beg);
+	stream.read(reinterpret_cast<char*>(&location),sizeof(location));
+	while ((location != 0) && stream.good()){
+		link = location + 4 ;	// skip the tablesize
+		stream.seekg(link,std::ios::beg);
+		stream.read(reinterpret_cast<char*>(&location),sizeof(location));
+	}
+	if (!stream.good()){
+		throw std::runtime_error("Unable to read the uop tables"s);
+	}
+	stream.seekp(0,std::ios::end);
+	auto table = static_cast<std::uint64_t>(stream.tellp()) ;
+	auto buffer = std::vector<std::uint8_t>(12 + static_cast<std::size_t>(default_table_size) * table_entry::entry_size,0) ;
+	std::copy(reinterpret_cast<const std::uint8_t*>(&default_table_size),reinterpret_cast<const std::uint8_t*>(&default_table_size)+4,buffer.data());
+	stream.write(reinterpret_cast<char*>(buffer.data()),buffer.size());
+	stream.seekp(link,std::ios::beg);
+	stream.write(reinterpret_cast<char*>(&table),sizeof(table));
+	return table + 12 ;
+}
+//=========================================================================================
+auto writeUOPEntry(std::iostream &stream, table_entry entry, const std::uint8_t *data, std::size_t size) ->void {
+	if (!validUOP(stream)){
+		throw std::runtime_error("Not a valid uop"s);
+	}
+	auto entries = gatherTableEntries(stream) ;
+	auto offsets = gatherEntryOffsets(stream) ;
+	if (entries.size() != offsets.size()){
+		throw std::runtime_error("Unable to read the uop tables"s);
+	}
+	auto index = findEntry(entries, entry.identifier) ;
+	auto reuse = false ;
+	if (index < entries.size()){
+		// Can we write over the old data?
+		const auto &old = entries[index] ;
+		reuse = (size <= static_cast<std::uint64_t>(old.header_length) + old.compressed_length) ;
+		for (std::size_t j = 0 ; reuse && (j < entries.size()) ; j++){
+			if ((j != index) && entries[j].valid() && (entries[j].offset == old.offset)){
+				reuse = false ;
+			}
+		}
+		if (reuse){
+			entry.offset = old.offset ;
+		}
+	}
+	auto location = std::uint64_t(0) ;
+	if (index < entries.size()){
+		location = offsets[index] ;
+	}
+	else {
+		// A new entry, find a free slot
+		index = 0 ;
+		while ((index < entries.size()) && entries[index].valid()){
+			index++ ;
+		}
+		location = (index < entries.size()) ? offsets[index] : appendTable(stream) ;
+		adjustEntryCount(stream, 1) ;
+	}
+	if (reuse){
+		stream.seekp(entry.offset,std::ios::beg);
+	}
+	else {
+		stream.seekp(0,std::ios::end);
+		entry.offset = static_cast<std::uint64_t>(stream.tellp()) ;
+	}
+	stream.write(reinterpret_cast<const char*>(data),size);
+	stream.seekp(location,std::ios::beg);
+	entry.save(stream) ;
+	if (!stream.good()){
+		throw std::runtime_error("Error writing the uop entry"s);
+	}
+}
+//=========================================================================================
+auto removeUOPEntry(std::iostream &stream, std::uint64_t identifier) ->bool {
+	if (!validUOP(stream)){
+		throw std::runtime_error("Not a valid uop"s);
+	}
+	auto entries = gatherTableEntries(stream) ;
+	auto offsets = gatherEntryOffsets(stream) ;
+	auto index = findEntry(entries, identifier) ;
+	if (index >= std::min(entries.size(),offsets.size())){
+		return false ;
+	}
+	stream.seekp(offsets[index],std::ios::beg);
+	table_entry().save(stream) ;
+	adjustEntryCount(stream, -1) ;
+	if (!stream.good()){
+		throw std::runtime_error("Error writing the uop entry"s);
+	}
+	return true ;
+}
@@ -7,8 +7,10 @@
 #include <string>
 #include <fstream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <utility>
+#include <filesystem>
 #include "hash.hpp"
 //================================================================================
 // A collection of functions to access and create uop files
@@ -52,8 +54,10 @@ struct table_entry {
 	table_entry() ;
 	table_entry(std::istream &input);
 	auto load(std::istream &input) ->table_entry & ;
+	auto load(const std::uint8_t *data) ->table_entry & ;		// data must have entry_size bytes
 	auto valid() const ->bool;
 	auto save(std::ostream &output) ->table_entry & ;
+	auto save(std::uint8_t *data) const ->const table_entry & ;	// data must have entry_size bytes
 	auto description() const ->void ;
 };
 
@@ -65,19 +69,78 @@ auto validUOP(std::istream &input) ->bool ;
 //=================================================================================
 // This returns a the offsets for each table entry ;
 auto gatherEntryOffsets(std::istream &input) ->std::vector<std::uint64_t> ;
+//=================================================================================
+// This returns every table entry (valid or not) in file order, the same order as
+// gatherEntryOffsets. Each table is read with a single read
+auto gatherTableEntries(std::istream &input) ->std::vector<table_entry> ;
 //==================================================================================
 // This writes the uop header and initializes table entrys for the number of of items
 // Returns an array of offsets for each table_entry
 auto createUOP(std::ostream &output, std::uint32_t numitems) ->std::vector<std::uint64_t> ;
 
+//==================================================================================
+//  uopwriter_t ;
+//==================================================================================
+// Writes a uop front to back.  The header and empty tables are written when it is
+// opened, the data for each entry is streamed after them as it is added, and the
+// table entries are kept until close, which writes each table with a single write.
+// So, other than one seek per table at the end, the file is written sequentially.
+// The layout is the same as createUOP followed by writing each entry in turn.
+// With dedup, data identical to data already written is not written again, the entry
+// points at the earlier copy (so several entries can share one block of data).  Only
+// where each block was written is kept, a possible match is confirmed by reading the
+// block back from the file.
+class uopwriter_t {
+	struct block_t {
+		std::uint64_t offset ;
+		std::size_t size ;
+		std::uint32_t data_block_hash ;
+	};
+	std::vector<char> buffer ;
+	std::filesystem::path filepath ;
+	std::fstream output ;
+	std::vector<std::uint64_t> offsets ;	// where each table entry is in the file
+	std::vector<table_entry> entries ;
+	std::uint64_t location ;				// where the next data goes
+	bool dedup ;
+	// The blocks written (for dedup), by the hash of their data
+	std::unordered_multimap<std::uint64_t,block_t> written ;
+	std::vector<std::uint8_t> check ;		// a written block read back, to compare
+	auto matches(const block_t &block, std::uint32_t data_block_hash, const std::uint8_t *data, std::size_t size) ->bool ;
+public:
+	static constexpr auto buffer_size = std::size_t(1024 * 1024) ;
+	uopwriter_t(const std::filesystem::path &path, std::uint32_t numentries, bool dedup = false) ;
+	uopwriter_t(const uopwriter_t&) = delete ;
+	auto operator=(const uopwriter_t&) ->uopwriter_t& = delete ;
+	auto is_open() const ->bool ;
+	// Writes the data, and sets the entry offset to (and returns) where it was written
+	// (or, with dedup, where it was already)
+	auto add(table_entry entry, const std::uint8_t *data, std::size_t size) ->std::uint64_t ;
+	// Writes the tables and closes the file, throws if any of the file could not be written
+	auto close() ->void ;
+};
+
 
 //==========================================================================================
 // This taks a hashset_t (a series of hashes mapped to item ids), and returns a map of your item ids,
 // and their correponding table entry when reading an existing uop file. If they id is not present,
 // it will not be included in the map
-auto createIDTableMapping(std::istream &input, const hashset_t &hashmapping, const std::vector<std::uint64_t> &offsets ) ->std::map<std::uint32_t,table_entry> ;
+auto createIDTableMapping(std::istream &input, const hashset_t &hashmapping) ->std::map<std::uint32_t,table_entry> ;
 
 //===========================================================================================
 // Update the hashes
 auto updateBlockHash(std::iostream &stream) ->void ;
+
+//===========================================================================================
+// In place changes to an existing uop, nothing but the data and the affected table
+// entry (and the entry count in the header) is written.
+//
+// writeUOPEntry replaces the entry with the same identifier, or adds it to the first
+// free slot (a new table is added if there isnt one). The data is written over the old
+// data if it fits and no other entry points at it, otherwise it is appended to the end
+// of the file. The offset of the entry is set to where the data was written.
+auto writeUOPEntry(std::iostream &stream, table_entry entry, const std::uint8_t *data, std::size_t size) ->void ;
+// Removes the entry with the identifier, returns false if it was not found.  The data
+// is left in the file (unreferenced)
+auto removeUOPEntry(std::iostream &stream, std::uint64_t identifier) ->bool ;
 #endif /* uop_hpp */
@@ -0,0 +1,87 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <random>
+#include <fstream>
+
+#include "multi.hpp"
+#include "strutil.hpp"
+
+using namespace std::string_literals ;
+//================================================================================================
+//  Useage:
+//      uoptest
+//
+//  Round trips small uops (a csv directory to a uop, and back through multistorage_t),
+//  the table in a file this small is far shorter than the header's table size.
+//  Exits with failure, and says why, on the first thing that does not match
+//
+//================================================================================================
+
+//================================================================================================
+static auto check(bool condition, const std::string &what) ->void {
+    if (!condition){
+        throw std::runtime_error("Failed: "s + what);
+    }
+}
+//================================================================================================
+// A csv directory with the multis (by id, the component lines) and a housing.bin,
+// saved as a uop and then read back
+static auto roundTrip(const std::filesystem::path &directory, const std::map<std::uint32_t,std::vector<std::string>> &multis) ->void {
+    std::filesystem::create_directories(directory) ;
+    for (const auto &[id,lines] : multis){
+        auto output = std::ofstream((directory / strutil::format("%.4u.csv",id)).string()) ;
+        output << "TileID,OffsetX,OffsetY,OffsetZ,Flag,Cliloc\n";
+        for (const auto &line : lines){
+            output << line << "\n";
+        }
+    }
+    auto house = std::vector<std::uint8_t>(5200) ;
+    for (std::size_t j = 0 ; j < house.size() ; j++){
+        house[j] = static_cast<std::uint8_t>(j * 7) ;
+    }
+    {
+        auto output = std::ofstream((directory / "housing.bin").string(),std::ios::binary) ;
+        output.write(reinterpret_cast<const char*>(house.data()),house.size()) ;
+    }
+    auto uoppath = directory / "MultiCollection.uop" ;
+    multistorage_t::saveUOP(directory, uoppath, "housing.bin", 1) ;
+
+    auto storage = multistorage_t(uoppath) ;
+    auto ids = storage.ids(false) ;
+    check(ids.size() == multis.size(), "entry count of "s + uoppath.string());
+    for (const auto &[id,lines] : multis){
+        check(storage[id].record(true) == multi_t(lines).record(true), "record of "s + std::to_string(id));
+    }
+    check(storage.housing() == house, "housing.bin");
+}
+
+//================================================================================================
+int main() {
+    auto exitcode = EXIT_SUCCESS;
+    auto directory = std::filesystem::temp_directory_path() / ("uoptest-"s + std::to_string(std::random_device()())) ;
+    try {
+        roundTrip(directory / "one", {
+            {2, {"0x75e4,-5,-12,1,0x100000001,1635320116:2574571355:"}}
+        });
+        roundTrip(directory / "few", {
+            {2, {"0x75e4,-5,-12,1,0x100000001,1635320116:2574571355:"}},
+            {3, {"0x182b,-13,16,8,0x0,639429657:15877635:", "0xccff,-16,-12,42,0x5,"}},
+            {14, {"0xaa74,-5,-12,36,0x5,3383158289:1798462792:"}}
+        });
+        std::cout << "uop round trips passed\n";
+    }
+    catch(const std::exception &e){
+        std::cerr<<e.what()<<std::endl;
+        exitcode = EXIT_FAILURE;
+    }
+    auto ec = std::error_code() ;
+    std::filesystem::remove_all(directory, ec) ;
+    return exitcode;
+}